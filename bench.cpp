@@ -0,0 +1,295 @@
+//
+// bench.cpp - time each phase of making a profile on synthetic dems
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "memory.h"
+#include "inout.h"
+#include "dem.h"
+#include "profile.h"
+#include "render.h"
+#include "swath.h"
+#include "parallel.h"
+#include "timer.h"
+#include "CLI11.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <sys/stat.h>
+
+//
+// deterministic fractal terrain: octaves of hashed value noise
+//
+
+static float lattice(const uint32_t seed, const int64_t x, const int64_t y) {
+  uint64_t h = (uint64_t)x * 0x9e3779b97f4a7c15ULL ^ (uint64_t)y * 0xc2b2ae3d27d4eb4fULL ^ seed;
+  h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 32;
+  return (float)(h & 0xffffff) / (float)0xffffff;
+}
+
+static float value_noise(const uint32_t seed, const float x, const float y) {
+  const int64_t ix = (int64_t)std::floor(x);
+  const int64_t iy = (int64_t)std::floor(y);
+  float fx = x - ix;
+  float fy = y - iy;
+  fx = fx*fx*(3.f-2.f*fx);
+  fy = fy*fy*(3.f-2.f*fy);
+  const float a = lattice(seed, ix, iy);
+  const float b = lattice(seed, ix+1, iy);
+  const float c = lattice(seed, ix, iy+1);
+  const float d = lattice(seed, ix+1, iy+1);
+  return (a + fx*(b-a)) + fy*((c + fx*(d-c)) - (a + fx*(b-a)));
+}
+
+// fBm with the largest features a quarter of the dem across, scaled to 0..1
+static float fbm(const uint32_t seed, const int64_t n, const int64_t x, const int64_t y) {
+  float sum = 0.f, amp = 0.5f, norm = 0.f;
+  float freq = 4.f / n;
+  for (int o=0; o<10; ++o) {
+    sum += amp * value_noise(seed+o, x*freq, y*freq);
+    norm += amp;
+    amp *= 0.5f;
+    freq *= 2.f;
+  }
+  return sum / norm;
+}
+
+// write an n x n dem png row by row, so any size fits in memory
+static void write_fractal_png(const std::string& path, const int64_t n, const int bits,
+                              const size_t nthreads) {
+  FILE* fp = fopen(path.c_str(), "wb");
+  if (!fp) {
+    std::cerr << "Could not open " << path << "\n";
+    exit(1);
+  }
+  png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    std::cerr << "Could not write " << path << "\n";
+    exit(1);
+  }
+  png_init_io(png_ptr, fp);
+  png_set_compression_level(png_ptr, 1);
+  png_set_IHDR(png_ptr, info_ptr, n, n, bits, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+  png_write_info(png_ptr, info_ptr);
+
+  // make rows in parallel batches
+  const int64_t batch = 64;
+  const int64_t bpp = bits / 8;
+  std::vector<png_byte> rows(batch * n * bpp);
+  for (int64_t r0=0; r0<n; r0+=batch) {
+    const int64_t nr = std::min(batch, n-r0);
+    parallel_for(nr, nthreads, [&](const size_t k) {
+      png_byte* row = rows.data() + k*n*bpp;
+      for (int64_t x=0; x<n; ++x) {
+        const float v = fbm(12345, n, x, r0+k);
+        if (bits == 16) {
+          const int p = (int)(0.5f + 65534.f*v);
+          row[2*x] = (png_byte)(p/256);
+          row[2*x+1] = (png_byte)(p%256);
+        } else {
+          row[x] = (png_byte)(0.5f + 254.f*v);
+        }
+      }
+    });
+    for (int64_t k=0; k<nr; ++k) png_write_row(png_ptr, rows.data() + k*n*bpp);
+  }
+  png_write_end(png_ptr, info_ptr);
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  fclose(fp);
+}
+
+//
+// decode every row of a gray png with libpng alone, then convert it to
+// floats with the conversion read_png_rows uses, timing the two apart
+//
+static void time_decode(const std::string& path, double& tdecode, double& tconvert) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    std::cerr << "Could not open " << path << "\n";
+    exit(1);
+  }
+  png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    std::cerr << "Could not read " << path << "\n";
+    exit(1);
+  }
+  png_init_io(png_ptr, fp);
+  png_read_info(png_ptr, info_ptr);
+  const int64_t nx = png_get_image_width(png_ptr, info_ptr);
+  const int64_t ny = png_get_image_height(png_ptr, info_ptr);
+  const int bits = png_get_bit_depth(png_ptr, info_ptr);
+  std::vector<png_byte> buf(png_get_rowbytes(png_ptr, info_ptr));
+  std::vector<float> vals(nx);
+
+  tdecode = tconvert = 0.0;
+  float acc = 0.f;
+  for (int64_t row=0; row<ny; ++row) {
+    const double t0 = wall_seconds();
+    png_read_row(png_ptr, buf.data(), NULL);
+    const double t1 = wall_seconds();
+    convert_png_gray_row(buf.data(), (int)nx, bits, 0.f, 1.f, vals.data());
+    acc += vals[row % nx];
+    tdecode += t1 - t0;
+    tconvert += wall_seconds() - t1;
+  }
+  png_read_end(png_ptr, info_ptr);
+  png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+  fclose(fp);
+  if (acc < 0.f) std::cout << acc;
+}
+
+//
+// run every phase over a matrix of inputs and record times
+//
+
+int main(int argc, char const *argv[]) {
+
+  CLI::App app{"Benchmark the phases of makeprofile on synthetic dems"};
+  std::vector<int64_t> sizes = {1024, 4096, 16384};
+  app.add_option("--sizes", sizes, "dem edge lengths in pixels, default 1024,4096,16384 (up to 50000 works given disk)")->delimiter(',');
+  std::vector<int> depths = {8, 16};
+  app.add_option("--bits", depths, "png bit depths, default 8,16")->delimiter(',');
+  std::vector<float> angles = {0.f, 30.f, 45.f};
+  app.add_option("--angles", angles, "line angles, degrees, default 0,30,45")->delimiter(',');
+  std::vector<size_t> widths = {1000, 4000};
+  app.add_option("--ox", widths, "output widths, default 1000,4000")->delimiter(',');
+  std::vector<size_t> heights = {1000};
+  app.add_option("--oy", heights, "output heights, default 1000")->delimiter(',');
+  std::vector<size_t> threads = {1, 0};
+  app.add_option("--threads", threads, "thread counts for the parallel phases, 0 is all cores, default 1,0")->delimiter(',');
+  std::string dir = "/tmp";
+  app.add_option("--dir", dir, "directory for the generated dems, which are kept between runs");
+  std::string csvfile = "bench.csv";
+  app.add_option("--csv", csvfile, "file to append results to, default bench.csv");
+  double mintime = 0.2;
+  app.add_option("--min-time", mintime, "repeat fast phases until they take this many seconds, default 0.2");
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError &e) {
+    return app.exit(e);
+  }
+
+  std::ifstream probe(csvfile);
+  const bool fresh = !probe.good();
+  probe.close();
+  std::ofstream csv(csvfile, std::ios::app);
+  if (fresh) csv << "time,size,bits,angle,ox,oy,threads,phase,seconds,rate,unit\n";
+  const long stamp = (long)time(nullptr);
+  const size_t budget = memory_budget(0);
+
+  for (const int64_t n : sizes) {
+    for (const int bits : depths) {
+
+      // generate once, and reuse on later runs
+      const std::string path = dir + "/makeprofile_bench_" + std::to_string(n) + "_" + std::to_string(bits) + ".png";
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0) {
+        std::cout << "Generating " << path << std::endl;
+        write_fractal_png(path, n, bits, 0);
+      }
+
+      // one result row per phase
+      auto record = [&](const float angle, const size_t ox, const size_t oy, const size_t nt,
+                        const std::string& phase, const double secs, const double work,
+                        const std::string& unit) {
+        csv << stamp << "," << n << "," << bits << "," << angle << "," << ox << "," << oy << ","
+            << default_threads(nt) << "," << phase << "," << secs << "," << work/secs/1.e+6 << "," << unit << "\n";
+        printf("  %6ld %2d-bit %5.1f deg %5zu x %-5zu %3zu thr  %-12s %10.6f s  %9.2f %s\n",
+               (long)n, bits, angle, ox, oy, default_threads(nt), phase.c_str(), secs, work/secs/1.e+6, unit.c_str());
+      };
+      // time fn, repeating it until mintime has passed, and return seconds per call
+      auto timed = [&](const std::function<void()>& fn) {
+        size_t reps = 0;
+        const double t0 = wall_seconds();
+        double t1 = t0;
+        do { fn(); ++reps; t1 = wall_seconds(); } while (t1-t0 < mintime);
+        return (t1-t0) / reps;
+      };
+
+      // reading
+      int hgt = 0, wdt = 0;
+      const double theader = timed([&]() { (void) read_png_res(path.c_str(), &hgt, &wdt); });
+      record(0.f, 0, 0, 1, "header", theader, 1.0, "Mcalls/s");
+
+      const double pixels = (double)n*n;
+      double tdecode, tconvert;
+      time_decode(path, tdecode, tconvert);
+      record(0.f, 0, 0, 1, "decode", tdecode, pixels, "Mpix/s");
+      record(0.f, 0, 0, 1, "convert", tconvert, pixels, "Mpix/s");
+
+      // the full read as makeprofile does it: decode, convert and transpose
+      // into columns, or beyond what fits in memory, page through a scratch file
+      std::unique_ptr<DemGrid> grid;
+      float** dem = nullptr;
+      const double t1 = wall_seconds();
+      if (n*n*(sizeof(float)+2) > budget) {
+        grid.reset(new PagedDem(path, n, n, DemEncoding(), budget, dir));
+      } else {
+        dem = allocate_2d_array_f(n, n);
+        read_dem_png(path, n, n, DemEncoding(), dem);
+        grid.reset(new InCoreDem(dem, n, n));
+      }
+      const double tread = wall_seconds() - t1;
+      record(0.f, 0, 0, 1, "read", tread, pixels, "Mpix/s");
+
+      for (const float angle : angles) {
+        float sx = 0.f, sy = n/2.f, fx = n, fy = n/2.f;
+        findIntersection(0.5f*n, 0.5f*n, angle+180.f, n, n, sx, sy);
+        findIntersection(0.5f*n, 0.5f*n, angle, n, n, fx, fy);
+
+        for (const size_t ox : widths) {
+          std::vector<float> profile(ox);
+          const double tsample = timed([&]() { sample_bilinear(*grid, sx, sy, fx, fy, ox, profile.data()); });
+          record(angle, ox, 0, 1, "sample", tsample, ox, "Msamples/s");
+
+          for (const size_t nt : threads) {
+            LineSet lines;
+            const size_t nlines = 64;
+            const double tlines = timed([&]() {
+              sample_parallel_lines(*grid, sx, sy, fx, fy, ox, -0.05f*n, 0.05f*n, nlines, nt, lines);
+            });
+            record(angle, ox, 0, nt, "sample_lines", tlines, (double)ox*nlines, "Msamples/s");
+          }
+
+          for (const size_t oy : heights) {
+            float** profimg = allocate_2d_array_f(ox, oy);
+            png_byte** rows = allocate_2d_array_pb(ox, oy, 16);
+            const double opix = (double)ox*oy;
+
+            const double traster = timed([&]() { render_profile(profile.data(), ox, oy, profimg); });
+            record(angle, ox, oy, 1, "rasterize", traster, opix, "Mpix/s");
+            const double tquant = timed([&]() { quantize_png_gray(ox, oy, TRUE, profimg, 0.f, 1.f, rows); });
+            record(angle, ox, oy, 1, "quantize", tquant, opix, "Mpix/s");
+            const std::string outfile = dir + "/makeprofile_bench_out.png";
+            const double tencode = timed([&]() {
+              (void) write_png_rows(outfile.c_str(), ox, oy, 16, PNG_COLOR_TYPE_GRAY, -1, rows);
+            });
+            record(angle, ox, oy, 1, "encode", tencode, opix, "Mpix/s");
+
+            free_2d_array_pb(rows);
+            free_2d_array_f(profimg);
+          }
+        }
+      }
+
+      grid.reset();
+      if (dem) free_2d_array_f(dem);
+      csv.flush();
+    }
+  }
+
+  std::cout << "Appended results to " << csvfile << std::endl;
+  return 0;
+}
@@ -0,0 +1,227 @@
+//
+// dem.cpp - elevation grids that may be larger than memory
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "dem.h"
+#include "inout.h"
+#include "trace.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+//
+// the whole dem in memory is a single tile
+//
+InCoreDem::InCoreDem(float** _dem, const int64_t _nx, const int64_t _ny)
+  : DemGrid(_nx, _ny) {
+  std::shared_ptr<DemTile> t = std::make_shared<DemTile>();
+  t->nx = _nx;
+  t->ny = _ny;
+  t->ystride = _ny;
+  t->data = _dem[0];
+  all = t;
+}
+
+//
+// look up a tile, loading and evicting as needed
+//
+TilePtr TileCache::get(const int64_t key) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = index.find(key);
+    if (it != index.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+      return it->second->second;
+    }
+  }
+
+  // load outside of the lock so that other threads can keep sampling;
+  // two threads may race to load the same tile, and the loser's copy is dropped
+  TilePtr t;
+  {
+    TraceSpan span("load tile", key);
+    t = load(key);
+  }
+
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = index.find(key);
+  if (it != index.end()) return it->second->second;
+
+  lru.emplace_front(key, t);
+  index[key] = lru.begin();
+  curbytes += t->bytes();
+  ++nloads;
+
+  // evict from the back, but always keep the new tile; samplers may
+  // still hold evicted tiles, which are freed when they let go
+  while (curbytes > maxbytes && lru.size() > 1) {
+    curbytes -= lru.back().second->bytes();
+    index.erase(lru.back().first);
+    lru.pop_back();
+  }
+  trace_counter("tile cache bytes", curbytes);
+  return t;
+}
+
+//
+// state used while streaming png rows into the scratch file
+//
+struct PagedFill {
+  int fd;
+  int64_t nx, ny, tsize, ntx;
+  std::vector<float> band;      // tsize rows of nx values, row-major
+  std::vector<float> tile;      // one tile, dem-ordered
+};
+
+static void write_band(PagedFill& pf, const int64_t tj) {
+  const int64_t y0 = tj * pf.tsize;
+  const int64_t bny = std::min(pf.tsize, pf.ny - y0);
+  for (int64_t ti=0; ti<pf.ntx; ++ti) {
+    const int64_t x0 = ti * pf.tsize;
+    const int64_t bnx = std::min(pf.tsize, pf.nx - x0);
+    std::fill(pf.tile.begin(), pf.tile.end(), 0.f);
+    for (int64_t i=0; i<bnx; ++i) {
+      for (int64_t j=0; j<bny; ++j) {
+        pf.tile[i*pf.tsize + j] = pf.band[j*pf.nx + x0 + i];
+      }
+    }
+    const size_t tbytes = pf.tsize * pf.tsize * sizeof(float);
+    const off_t offset = (off_t)(tj*pf.ntx + ti) * tbytes;
+    if (pwrite(pf.fd, pf.tile.data(), tbytes, offset) != (ssize_t)tbytes) {
+      perror("Could not write dem scratch file");
+      exit(1);
+    }
+  }
+}
+
+static int paged_row(void* ctx, const int j, const float* vals) {
+  PagedFill& pf = *(PagedFill*)ctx;
+  const int64_t jj = j % pf.tsize;
+  std::copy(vals, vals+pf.nx, pf.band.begin() + jj*pf.nx);
+  // rows arrive top to bottom, so a band is complete at its lowest row
+  if (jj == 0) write_band(pf, j / pf.tsize);
+  return 0;
+}
+
+constexpr int64_t PagedDem::tsize;
+
+PagedDem::PagedDem(const std::string& pngfile, const int64_t _nx, const int64_t _ny,
+                   const DemEncoding& enc, const size_t budget, const std::string& scratchdir)
+  : DemGrid(_nx, _ny),
+    ntx((_nx+tsize-1)/tsize),
+    nty((_ny+tsize-1)/tsize),
+    cache(budget, [this](const int64_t key) { return read_tile(key); }) {
+
+  // unlink right away so the scratch file vanishes when we exit
+  std::string tmpl = scratchdir + "/makeprofile_XXXXXX";
+  std::vector<char> name(tmpl.begin(), tmpl.end());
+  name.push_back('\0');
+  fd = mkstemp(name.data());
+  if (fd < 0) {
+    std::cerr << "Could not create scratch file in " << scratchdir << "\n";
+    exit(1);
+  }
+  unlink(name.data());
+
+  std::cout << "  paging " << ntx*nty << " tiles of " << tsize << "^2 through " << scratchdir << "\n";
+
+  PagedFill pf;
+  pf.fd = fd;
+  pf.nx = nx;
+  pf.ny = ny;
+  pf.tsize = tsize;
+  pf.ntx = ntx;
+  pf.band.resize(tsize * nx);
+  pf.tile.resize(tsize * tsize);
+  if (enc.encoding == ENCODING_GRAY) {
+    (void) read_png_rows(pngfile.c_str(), (int)nx, (int)ny, ENCODING_GRAY, 0.0, 1.0, paged_row, &pf);
+  } else {
+    const float range = 1.f / (enc.hi - enc.lo);
+    (void) read_png_rows(pngfile.c_str(), (int)nx, (int)ny, enc.encoding, -enc.lo*range, range, paged_row, &pf);
+  }
+}
+
+PagedDem::~PagedDem() {
+  close(fd);
+}
+
+std::shared_ptr<DemTile> PagedDem::read_tile(const int64_t key) {
+  const int64_t ti = key % ntx;
+  const int64_t tj = key / ntx;
+  std::shared_ptr<DemTile> t = std::make_shared<DemTile>();
+  t->x0 = ti * tsize;
+  t->y0 = tj * tsize;
+  t->nx = std::min(tsize, nx - t->x0);
+  t->ny = std::min(tsize, ny - t->y0);
+  t->ystride = tsize;
+  t->store.resize(tsize * tsize);
+  t->data = t->store.data();
+
+  const size_t tbytes = tsize * tsize * sizeof(float);
+  if (pread(fd, t->store.data(), tbytes, (off_t)key * tbytes) != (ssize_t)tbytes) {
+    perror("Could not read dem scratch file");
+    exit(1);
+  }
+  return t;
+}
+
+TilePtr PagedDem::tile_at(const int64_t ix, const int64_t iy) {
+  return cache.get((iy/tsize)*ntx + ix/tsize);
+}
+
+//
+// pixel encodings
+//
+int DemEncoding::parse(const std::string& name) {
+  if (name == "gray") return ENCODING_GRAY;
+  if (name == "terrain-rgb") return ENCODING_TERRAIN_RGB;
+  if (name == "terrarium") return ENCODING_TERRARIUM;
+  std::cerr << "Unknown encoding " << name << ", use gray, terrain-rgb or terrarium\n";
+  exit(0);
+}
+
+void read_dem_png(const std::string& path, const int64_t nx, const int64_t ny,
+                  const DemEncoding& enc, float** cols) {
+  if (enc.encoding == ENCODING_GRAY) {
+    // read the first channel into the elevation array, scaled as 0..vscale
+    (void) read_png (path.c_str(), (int)nx, (int)ny, 0, 0, 0.0, 0,
+                     cols, 0.0, 1.0, nullptr, 0.0, 1.0, nullptr, 0.0, 1.0);
+  } else {
+    // decode rgb pixels straight to one channel, scaled so lo..hi is 0..1
+    const float range = 1.f / (enc.hi - enc.lo);
+    (void) read_png_encoded (path.c_str(), (int)nx, (int)ny, enc.encoding,
+                             cols, -enc.lo*range, range);
+  }
+}
+
+bool try_read_dem_png(const std::string& path, const int64_t nx, const int64_t ny,
+                      const DemEncoding& enc, float** cols, std::string& err) {
+  // gray rows convert to the same fractions read_png makes
+  float lo = 0.f, range = 1.f;
+  if (enc.encoding != ENCODING_GRAY) {
+    range = 1.f / (enc.hi - enc.lo);
+    lo = -enc.lo*range;
+  }
+  char msg[512];
+  if (try_read_png_encoded(path.c_str(), (int)nx, (int)ny, enc.encoding, cols, lo, range,
+                           msg, sizeof(msg)) < 0) {
+    err = msg;
+    return false;
+  }
+  return true;
+}
+
+//
+// how many bytes may the dem use?
+//
+size_t memory_budget(const size_t megabytes) {
+  if (megabytes > 0) return megabytes << 20;
+  const long pages = sysconf(_SC_PHYS_PAGES);
+  const long pagesize = sysconf(_SC_PAGE_SIZE);
+  if (pages <= 0 || pagesize <= 0) return (size_t)1 << 32;
+  return 3 * ((size_t)pages * (size_t)pagesize / 4);
+}
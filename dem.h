@@ -0,0 +1,176 @@
+//
+// dem.h - elevation grids that may be larger than memory
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+
+// a rectangular block of elevations, laid out like the dem arrays:
+//   value at cell (ix,iy) is data[(ix-x0)*ystride + (iy-y0)]
+struct DemTile {
+  int64_t x0 = 0, y0 = 0;       // first cell covered
+  int64_t nx = 0, ny = 0;       // number of valid cells in each direction
+  int64_t ystride = 0;          // distance between columns in data
+  const float* data = nullptr;  // points into store, or at external memory
+  std::vector<float> store;
+
+  bool contains(const int64_t ix, const int64_t iy) const {
+    return ix >= x0 && iy >= y0 && ix < x0+nx && iy < y0+ny;
+  }
+  size_t bytes() const { return sizeof(DemTile) + store.size()*sizeof(float); }
+};
+
+using TilePtr = std::shared_ptr<const DemTile>;
+
+// a virtual grid of elevations, nx by ny cells
+class DemGrid {
+public:
+  DemGrid(const int64_t _nx, const int64_t _ny) : nx(_nx), ny(_ny) {}
+  virtual ~DemGrid() {}
+
+  // return the tile holding cell (ix,iy), which is always inside the grid;
+  // must be safe to call from several threads at once
+  virtual TilePtr tile_at(const int64_t ix, const int64_t iy) = 0;
+
+  // how many tiles have been decoded or paged in so far
+  virtual size_t tiles_loaded() const { return 0; }
+
+  // the single tile holding every cell, if the grid is one array in
+  // memory, or null; never loads anything
+  virtual TilePtr whole() const { return nullptr; }
+
+  const int64_t nx, ny;
+};
+
+// the usual case: the whole dem is one allocate_2d_array_f array
+class InCoreDem : public DemGrid {
+public:
+  InCoreDem(float** _dem, const int64_t _nx, const int64_t _ny);
+  TilePtr tile_at(const int64_t, const int64_t) override { return all; }
+  TilePtr whole() const override { return all; }
+private:
+  TilePtr all;
+};
+
+// thread-safe least-recently-used cache of tiles bounded by total bytes
+class TileCache {
+public:
+  using Loader = std::function<std::shared_ptr<DemTile>(const int64_t)>;
+
+  TileCache(const size_t _maxbytes, Loader _load)
+    : maxbytes(_maxbytes), load(_load) {}
+
+  // return the tile with this key, loading it on first touch
+  TilePtr get(const int64_t key);
+
+  size_t loads() const { return nloads; }
+  size_t bytes() const { return curbytes; }
+
+private:
+  using Entry = std::pair<int64_t, TilePtr>;
+  const size_t maxbytes;
+  Loader load;
+  std::mutex mtx;
+  std::list<Entry> lru;         // most recent at the front
+  std::unordered_map<int64_t, std::list<Entry>::iterator> index;
+  size_t curbytes = 0;
+  size_t nloads = 0;
+};
+
+// how png pixels become the 0..1 elevations the sampler works with
+struct DemEncoding {
+  int encoding = 0;             // ENCODING_GRAY, _TERRAIN_RGB or _TERRARIUM
+  float lo = 0.f, hi = 9000.f;  // meters mapped to 0 and 1 for rgb encodings
+
+  // parse "gray", "terrain-rgb" or "terrarium"
+  static int parse(const std::string& name);
+};
+
+// read a whole png of this encoding into columns laid out like a dem array
+void read_dem_png(const std::string& path, const int64_t nx, const int64_t ny,
+                  const DemEncoding& enc, float** cols);
+
+// the same, to the same values, but a missing, unusable, corrupt or
+// truncated png returns false with the reason in err instead of exiting
+bool try_read_dem_png(const std::string& path, const int64_t nx, const int64_t ny,
+                      const DemEncoding& enc, float** cols, std::string& err);
+
+// a dem which does not fit in the memory budget: stream the png once into
+// a tiled scratch file, then page tiles back in through a TileCache
+class PagedDem : public DemGrid {
+public:
+  PagedDem(const std::string& pngfile, const int64_t _nx, const int64_t _ny,
+           const DemEncoding& enc, const size_t budget, const std::string& scratchdir);
+  ~PagedDem();
+  TilePtr tile_at(const int64_t ix, const int64_t iy) override;
+  size_t tiles_loaded() const override { return cache.loads(); }
+
+  static constexpr int64_t tsize = 512;
+
+private:
+  std::shared_ptr<DemTile> read_tile(const int64_t key);
+  int fd;
+  const int64_t ntx, nty;
+  TileCache cache;
+};
+
+// per-thread accessor into a DemGrid; remembers the last few tiles
+// so that nearly every lookup avoids the shared cache and its lock
+class DemSampler {
+public:
+  explicit DemSampler(DemGrid& _g) : g(_g) {}
+
+  int64_t nx() const { return g.nx; }
+  int64_t ny() const { return g.ny; }
+
+  // value at a cell, clamped to the grid
+  float at(int64_t ix, int64_t iy) {
+    ix = std::max((int64_t)0, std::min(g.nx-1, ix));
+    iy = std::max((int64_t)0, std::min(g.ny-1, iy));
+    for (int k=0; k<nrecent; ++k) {
+      const DemTile* t = recent[k].get();
+      if (t && t->contains(ix,iy)) return t->data[(ix-t->x0)*t->ystride + (iy-t->y0)];
+    }
+    TilePtr t = g.tile_at(ix, iy);
+    recent[next] = t;
+    next = (next+1) % nrecent;
+    return t->data[(ix-t->x0)*t->ystride + (iy-t->y0)];
+  }
+
+  // bilinear interpolation at a point in cell coordinates
+  float bilinear(const float tx, const float ty) {
+    const int64_t x1 = std::max((int64_t)0, std::min(g.nx-1, (int64_t)tx));
+    const int64_t y1 = std::max((int64_t)0, std::min(g.ny-1, (int64_t)ty));
+    const int64_t x2 = std::min(g.nx-1, x1+1);
+    const int64_t y2 = std::min(g.ny-1, y1+1);
+
+    const float x_diff = tx - x1;
+    const float y_diff = ty - y1;
+
+    return at(x1,y1) * (1 - x_diff) * (1 - y_diff) +
+           at(x2,y1) *      x_diff  * (1 - y_diff) +
+           at(x1,y2) * (1 - x_diff) *      y_diff +
+           at(x2,y2) *      x_diff  *      y_diff;
+  }
+
+private:
+  static constexpr int nrecent = 4;
+  DemGrid& g;
+  TilePtr recent[nrecent];
+  int next = 0;
+};
+
+// bytes available for the dem: the user's budget in MB, or 3/4 of physical memory
+size_t memory_budget(const size_t megabytes);
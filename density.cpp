@@ -0,0 +1,75 @@
+//
+// density.cpp - many profiles accumulated into one image
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "density.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <algorithm>
+
+// splitmix64
+static uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+void jitter(const uint64_t seed, const uint64_t k, float& u1, float& u2) {
+  const uint64_t h = mix(mix(seed) ^ k);
+  u1 = (float)(h >> 40) / (float)(1 << 23) - 1.f;
+  u2 = (float)((h >> 16) & 0xffffff) / (float)(1 << 23) - 1.f;
+}
+
+void accumulate_profile(const float* profile, const size_t ox, const size_t oy,
+                        float* acc) {
+  for (size_t i=0; i<ox; ++i) {
+    // reach halfway to each neighbor, at least a pixel tall
+    const float yc = profile[i] * oy;
+    const float yl = (i > 0) ? 0.5f*(yc + profile[i-1]*oy) : yc;
+    const float yr = (i+1 < ox) ? 0.5f*(yc + profile[i+1]*oy) : yc;
+    float bot = std::min(yc, std::min(yl, yr));
+    float top = std::max(yc, std::max(yl, yr));
+    if (top - bot < 1.f) {
+      const float mid = 0.5f*(top+bot);
+      bot = mid - 0.5f;
+      top = mid + 0.5f;
+    }
+
+    // spread one unit of weight over the span
+    const float wgt = 1.f / (top - bot);
+    float* col = acc + i*oy;
+    const int j0 = std::max(0, (int)std::floor(bot));
+    const int j1 = std::min((int)oy, (int)std::ceil(top));
+    for (int j=j0; j<j1; ++j) {
+      const float c = std::min(top, j+1.f) - std::max(bot, (float)j);
+      if (c > 0.f) col[j] += wgt * c;
+    }
+  }
+}
+
+void merge_tree(std::vector<std::vector<float>>& bufs, const size_t nthreads) {
+  for (size_t gap=1; gap<bufs.size(); gap*=2) {
+    const size_t npairs = (bufs.size() + 2*gap - 1) / (2*gap);
+    parallel_for(npairs, nthreads, [&](const size_t p) {
+      const size_t a = p * 2*gap;
+      const size_t b = a + gap;
+      if (b >= bufs.size()) return;
+      float* dst = bufs[a].data();
+      const float* src = bufs[b].data();
+      for (size_t k=0; k<bufs[a].size(); ++k) dst[k] += src[k];
+    });
+  }
+}
+
+void render_density(const std::vector<float>& acc, const size_t ox, const size_t oy,
+                    float** profimg) {
+  const float amax = *std::max_element(acc.begin(), acc.end());
+  const float scale = (amax > 0.f) ? 1.f/amax : 0.f;
+  for (size_t i=0; i<ox; ++i) {
+    for (size_t j=0; j<oy; ++j) profimg[i][j] = 1.f - scale * acc[i*oy + j];
+  }
+}
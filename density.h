@@ -0,0 +1,27 @@
+//
+// density.h - many profiles accumulated into one image
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// two uniform numbers in [-1,1) for line k, the same on any thread count
+void jitter(const uint64_t seed, const uint64_t k, float& u1, float& u2);
+
+// add the antialiased trace of a profile, one pixel thick and joined
+// across columns, into acc[i*oy + j]
+void accumulate_profile(const float* profile, const size_t ox, const size_t oy,
+                        float* acc);
+
+// sum all the buffers into bufs[0], pairwise in log2(n) rounds with each
+// round's merges on nthreads threads
+void merge_tree(std::vector<std::vector<float>>& bufs, const size_t nthreads);
+
+// the image of an accumulated density: white where empty, black at the max
+void render_density(const std::vector<float>& acc, const size_t ox, const size_t oy,
+                    float** profimg);
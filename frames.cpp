@@ -0,0 +1,51 @@
+//
+// frames.cpp - numbered multi-frame output
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "frames.h"
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+
+std::vector<float> parse_sweep(const std::string& spec) {
+  std::vector<double> vals;
+  std::stringstream ss(spec);
+  std::string item;
+  bool ok = true;
+  while (ok && std::getline(ss, item, ':')) {
+    char* end;
+    vals.push_back(strtod(item.c_str(), &end));
+    ok = !item.empty() && *end == '\0';
+  }
+  if (vals.size() == 2) vals.push_back(1.0);
+  if (!ok || vals.size() != 3 || vals[2] == 0.0 || (vals[1]-vals[0])*vals[2] < 0.0) {
+    std::cerr << "Sweep " << spec << " should be start:end:step, with step toward end\n";
+    exit(0);
+  }
+
+  // count steps in double so 0:359:0.1 gets all 3591
+  const size_t nframes = 1 + (size_t)std::floor((vals[1]-vals[0])/vals[2] + 1.e-6);
+  std::vector<float> angles(nframes);
+  for (size_t f=0; f<nframes; ++f) angles[f] = (float)(vals[0] + f*vals[2]);
+  return angles;
+}
+
+std::string frame_name(const std::string& outfile, const size_t frame, const size_t nframes) {
+  std::string stem = outfile;
+  std::string ext = ".png";
+  const size_t dot = outfile.rfind('.');
+  if (dot != std::string::npos && outfile.find('/', dot) == std::string::npos) {
+    stem = outfile.substr(0, dot);
+    ext = outfile.substr(dot);
+  }
+
+  size_t digits = 4;
+  for (size_t n=10000; n<nframes; n*=10) ++digits;
+  std::string num = std::to_string(frame);
+  if (num.size() < digits) num.insert(0, digits-num.size(), '0');
+  return stem + "_" + num + ext;
+}
@@ -0,0 +1,19 @@
+//
+// frames.h - numbered multi-frame output
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// angles from "start:end:step" or "start:end" (step 1), in degrees,
+// including end when the steps land on it
+std::vector<float> parse_sweep(const std::string& spec);
+
+// out.png becomes out_0000.png, out_0001.png, ... with enough digits
+// for nframes
+std::string frame_name(const std::string& outfile, const size_t frame, const size_t nframes);
@@ -0,0 +1,77 @@
+//
+// horizon.cpp - skylines seen from an observer on the dem
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "horizon.h"
+#include "profile.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <algorithm>
+
+// earth radius, stretched by the usual 0.13 refraction coefficient
+static const double earth_radius = 6371000.0 / (1.0 - 0.13);
+
+int horizon_levels(const DemGrid& grid, const size_t naz) {
+  const float far = std::hypot((float)grid.nx, (float)grid.ny);
+  return DemPyramid::levels_for(far * 2.f * pi() / naz);
+}
+
+void horizon_angles(DemPyramid& pyr, const Observer& obs, const float az0,
+                    const size_t naz, const size_t nthreads, float* angles) {
+
+  DemGrid& base = pyr.level(0);
+  const float xmax = base.nx - 1;
+  const float ymax = base.ny - 1;
+  const float zscale = obs.zhi - obs.zlo;
+  const float dtheta = 2.f * pi() / naz;
+
+  // the coarsest level's highest cell bounds the whole dem, which lets
+  // a ray stop once nothing further on could rise above its horizon
+  float zmax = 0.f;
+  {
+    DemGrid& top = pyr.level(pyr.levels()-1);
+    DemSampler ds(top);
+    zmax = ds.at(0, 0);
+    for (int64_t i=0; i<top.nx; ++i) {
+      for (int64_t j=0; j<top.ny; ++j) zmax = std::max(zmax, ds.at(i, j));
+    }
+    if (pyr.reduction() != REDUCE_MAX) zmax = 1.f;
+  }
+  DemSampler ground(base);
+  const float zeye = obs.zlo + zscale * ground.bilinear(obs.x, obs.y) + obs.height;
+  const float zpeak = obs.zlo + zscale * zmax;
+
+  // hand out blocks of rays so each thread reuses its samplers
+  const size_t block = 32;
+  parallel_for((naz+block-1)/block, nthreads, [&](const size_t b) {
+    PyramidSampler sampler(pyr);
+    for (size_t i=b*block; i<std::min(naz, (b+1)*block); ++i) {
+      const float az = (az0 + (i+0.5f)*360.f/naz) * pi() / 180.0;
+      const float dx = std::sin(az);
+      const float dy = std::cos(az);
+
+      // tangent of the steepest sight line so far
+      float best = -1.e+30f;
+      float d = 1.f;
+      while (true) {
+        const float tx = obs.x + d*dx;
+        const float ty = obs.y + d*dy;
+        if (tx < 0.f || ty < 0.f || tx > xmax || ty > ymax) break;
+
+        // rays are this many cells apart here
+        const float width = d * dtheta;
+        const float dist = d * obs.cellsize;
+        if ((zpeak - zeye) < best * dist) break;
+
+        float z = obs.zlo + zscale * sampler.sample(tx, ty, std::log2(std::max(1.f, width)));
+        if (obs.curvature) z -= (float)(0.5 * dist * dist / earth_radius);
+        best = std::max(best, (z - zeye) / dist);
+        d += std::max(0.5f, width);
+      }
+      angles[i] = (best > -1.e+29f) ? std::atan(best) * 180.0 / pi() : 0.f;
+    }
+  });
+}
@@ -0,0 +1,30 @@
+//
+// horizon.h - skylines seen from an observer on the dem
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "pyramid.h"
+
+#include <cstddef>
+
+// where the observer stands and how dem values map to meters
+struct Observer {
+  float x = 0.f, y = 0.f;       // position, in dem cells
+  float height = 2.f;           // eye above the ground, meters
+  float cellsize = 30.f;        // dem cell size, meters
+  float zlo = 0.f, zhi = 9000.f;  // meters at dem values 0 and 1
+  bool curvature = false;       // drop distant terrain below the tangent plane
+};
+
+// highest elevation angle, in degrees above level, of the terrain along
+// naz rays; ray i leaves at azimuth az0 + (i+0.5)*360/naz degrees,
+// clockwise from +y; distant steps read from the pyramid at the width
+// between neighboring rays, so the pyramid should be a max pyramid
+void horizon_angles(DemPyramid& pyr, const Observer& obs, const float az0,
+                    const size_t naz, const size_t nthreads, float* angles);
+
+// pyramid levels that horizon_angles needs for naz rays
+int horizon_levels(const DemGrid& grid, const size_t naz);
@@ -5,7 +5,295 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "inout.h"
+#include "memory.h"
+#include "simd.h"
+
+
+/*
+ * a growing buffer that png_write_rows_mem encodes into
+ */
+struct png_mem {
+   png_byte *data;
+   size_t len,cap;
+};
+
+static void png_mem_write (png_structp png_ptr, png_bytep buf, png_size_t len) {
+   struct png_mem *mem = (struct png_mem *)png_get_io_ptr(png_ptr);
+   png_byte *grown;
+   if (mem->len + len > mem->cap) {
+      mem->cap = 2*(mem->len + len);
+      grown = (png_byte *)realloc(mem->data, mem->cap);
+      if (grown == NULL) png_error(png_ptr, "out of memory");
+      mem->data = grown;
+   }
+   memcpy(mem->data + mem->len, buf, len);
+   mem->len += len;
+}
+
+static void png_mem_flush (png_structp png_ptr) {
+   (void)png_ptr;
+}
+
+
+/*
+ * encode rows of packed pixels, top row first, to a file or, if fp is
+ * NULL, to memory; without rows, fill packs each row in turn into one
+ * buffer
+ */
+static int encode_png_rows (FILE *fp, struct png_mem *mem, const int nx, const int ny,
+   const int bit_depth, const int color_type, const int complevel,
+   png_byte **rows, void (*fill)(void*, const int, png_byte*), void *ctx) {
+
+   // gamma of 1.8 looks normal on most monitors...that display properly.
+   //float gamma = 1.8;
+   // must do 5/9 for stuff to look right on Macs....why? I dunno.
+   float gamma = .55555;
+   png_uint_32 height,width;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   png_byte *row = NULL;
+   int j,channels;
+
+   // set the sizes in png-understandable format
+   height=ny;
+   width=nx;
+
+   // the one row that fill packs into
+   if (rows == NULL) {
+      channels = 1;
+      if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA) channels = 2;
+      else if (color_type == PNG_COLOR_TYPE_RGB) channels = 3;
+      else if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) channels = 4;
+      const int tag = mem_set_tag(MEM_ENCODE_ROWS);
+      row = (png_byte *)mem_alloc(((size_t)nx*channels*bit_depth + 7) / 8);
+      mem_set_tag(tag);
+   }
+
+   /* Create and initialize the png_struct with the desired error handler
+    * functions.  If you want to use the default stderr and longjump method,
+    * you can supply NULL for the last three parameters.  We also check that
+    * the library version is compatible with the one used at compile time,
+    * in case we are using dynamically linked libraries.  REQUIRED.
+    */
+   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+      NULL, NULL, NULL);
+
+   if (png_ptr == NULL) {
+      fprintf(stderr,"Could not create png struct\n");
+      fflush(stderr);
+      mem_free(row);
+      return (-1);
+   }
+
+   /* Allocate/initialize the image information data.  REQUIRED */
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL) {
+      png_destroy_write_struct(&png_ptr,(png_infopp)NULL);
+      mem_free(row);
+      return (-1);
+   }
+
+   /* Set error handling.  REQUIRED if you aren't supplying your own
+    * error handling functions in the png_create_write_struct() call.
+    */
+   if (setjmp(png_jmpbuf(png_ptr))) {
+      /* If we get here, we had a problem writing the image */
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      mem_free(row);
+      return (-1);
+   }
+
+   /* set up the output control if you are using standard C streams */
+   if (fp) png_init_io(png_ptr, fp);
+   else png_set_write_fn(png_ptr, mem, png_mem_write, png_mem_flush);
+
+   // zlib level 0..9, or -1 for its default; fast levels also skip
+   // the per-row filter search
+   if (complevel >= 0) {
+      png_set_compression_level(png_ptr, complevel);
+      png_set_filter(png_ptr, 0, PNG_FILTER_NONE);
+   }
+
+   /* Set the image information here.  Width and height are up to 2^31,
+    * bit_depth is one of 1, 2, 4, 8, or 16, but valid values also depend on
+    * the color_type selected. color_type is one of PNG_COLOR_TYPE_GRAY,
+    * PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_PALETTE, PNG_COLOR_TYPE_RGB,
+    * or PNG_COLOR_TYPE_RGB_ALPHA.  interlace is either PNG_INTERLACE_NONE or
+    * PNG_INTERLACE_ADAM7, and the compression_type and filter_type MUST
+    * currently be PNG_COMPRESSION_TYPE_BASE and PNG_FILTER_TYPE_BASE. REQUIRED
+    */
+   png_set_IHDR(png_ptr, info_ptr, width, height, bit_depth,
+      color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+      PNG_FILTER_TYPE_BASE);
+
+   /* Optional gamma chunk is strongly suggested if you have any guess
+    * as to the correct gamma of the image. */
+   //png_set_gAMA(png_ptr, info_ptr, 2.2);
+   png_set_gAMA(png_ptr, info_ptr, gamma);
+
+   /* Write the file header information.  REQUIRED */
+   png_write_info(png_ptr, info_ptr);
+
+   /* One of the following output methods is REQUIRED */
+   if (rows) {
+      png_write_image(png_ptr, rows);
+   } else {
+      for (j=0; j<ny; j++) {
+         fill(ctx, j, row);
+         png_write_row(png_ptr, row);
+      }
+   }
+
+   /* It is REQUIRED to call this to finish writing the rest of the file */
+   png_write_end(png_ptr, info_ptr);
+
+   /* clean up after the write, and free any memory allocated */
+   png_destroy_write_struct(&png_ptr, &info_ptr);
+   mem_free(row);
+
+   return(0);
+}
+
+
+/*
+ * write rows of packed pixels, top row first, to a png file
+ */
+int write_png_rows (const char *outfile, const int nx, const int ny,
+   const int bit_depth, const int color_type, const int complevel,
+   png_byte **rows) {
+
+   FILE *fp;
+   int retval;
+
+   // write the file
+   fp = fopen(outfile,"wb");
+   if (fp==NULL) {
+      fprintf(stderr,"Could not open output file %s\n",outfile);
+      fflush(stderr);
+      exit(0);
+   }
+
+   retval = encode_png_rows(fp, NULL, nx, ny, bit_depth, color_type, complevel, rows, NULL, NULL);
+
+   // close file
+   fclose(fp);
+
+   return(retval);
+}
+
+
+/*
+ * the same, but asking fill for each row, top row first, as it is
+ * written, so that the image never has to be in memory all at once
+ */
+int write_png_rows_fn (const char *outfile, const int nx, const int ny,
+   const int bit_depth, const int color_type, const int complevel,
+   void (*fill)(void*, const int, png_byte*), void *ctx) {
+
+   FILE *fp;
+   int retval;
+
+   fp = fopen(outfile,"wb");
+   if (fp==NULL) {
+      fprintf(stderr,"Could not open output file %s\n",outfile);
+      fflush(stderr);
+      exit(0);
+   }
+
+   retval = encode_png_rows(fp, NULL, nx, ny, bit_depth, color_type, complevel, NULL, fill, ctx);
+
+   fclose(fp);
+
+   return(retval);
+}
+
+
+/*
+ * the same, but to a malloc'd buffer in *out of *outlen bytes, which the
+ * caller frees; safe to call from several threads at once
+ */
+int write_png_rows_mem (const int nx, const int ny,
+   const int bit_depth, const int color_type, const int complevel,
+   png_byte **rows, png_byte **out, size_t *outlen) {
+
+   struct png_mem mem;
+   int retval;
+
+   // most profiles are mostly flat color, and compress well
+   mem.cap = 4096 + (size_t)nx*ny/8;
+   mem.len = 0;
+   mem.data = (png_byte *)malloc(mem.cap);
+   if (mem.data == NULL) return (-1);
+
+   retval = encode_png_rows(NULL, &mem, nx, ny, bit_depth, color_type, complevel, rows, NULL, NULL);
+   if (retval != 0) {
+      free(mem.data);
+      return(retval);
+   }
+   *out = mem.data;
+   *outlen = mem.len;
+   return(0);
+}
+
+
+/*
+ * pack a frame into 1-channel png rows from allocate_2d_array_pb
+ */
+void quantize_png_gray (const int nx, const int ny, const int high_depth,
+   float **red, float redmin, float redrange, png_byte **img) {
+
+   int i,j,ib,iend,printval;
+   // red is column-major, so convert blocks of columns at a time to
+   // keep their cache lines in use
+   const int block = 32;
+
+   // no scaling, 16-bit per channel
+   if (high_depth) {
+     for (ib=0; ib<nx; ib+=block) {
+       iend = (ib+block < nx) ? ib+block : nx;
+       for (j=ny-1; j>=0; j--) {
+         for (i=ib; i<iend; i++) {
+           printval = (int)(0.5 + 65534*(red[i][j]-redmin)/redrange);
+           if (printval<0) printval = 0;
+           else if (printval>65535) printval = 65535;
+           img[ny-1-j][2*i] = (png_byte)(printval/256);
+           img[ny-1-j][2*i+1] = (png_byte)(printval%256);
+         }
+       }
+     }
+
+   // no scaling, 8-bit per channel
+   } else {
+     for (ib=0; ib<nx; ib+=block) {
+       iend = (ib+block < nx) ? ib+block : nx;
+       for (j=ny-1; j>=0; j--) {
+         for (i=ib; i<iend; i++) {
+           printval = (int)(0.5 + 254*(red[i][j]-redmin)/redrange);
+           if (printval<0) printval = 0;
+           else if (printval>255) printval = 255;
+           img[ny-1-j][i] = (png_byte)printval;
+         }
+       }
+     }
+   }
+
+}
+
+
+/*
+ * print a frame to a 1-channel png using a caller-owned row buffer from
+ * allocate_2d_array_pb, so that several threads can write frames at once;
+ * complevel is the zlib level, or -1 for the default
+ */
+int write_png_gray (const char *outfile, const int nx, const int ny,
+   const int high_depth, float **red, float redmin, float redrange,
+   png_byte **img, const int complevel) {
+
+   quantize_png_gray(nx, ny, high_depth, red, redmin, redrange, img);
+   return write_png_rows(outfile, nx, ny, high_depth ? 16 : 8, PNG_COLOR_TYPE_GRAY, complevel, img);
+}
 
 
 /*
@@ -20,14 +308,6 @@ int write_png (const char *outfile, const int nx, const int ny,
    int autorange = FALSE;
    int i,j,printval,bit_depth;
    float newminrange,newmaxrange;
-   // gamma of 1.8 looks normal on most monitors...that display properly.
-   //float gamma = 1.8;
-   // must do 5/9 for stuff to look right on Macs....why? I dunno.
-   float gamma = .55555;
-   FILE *fp;
-   png_uint_32 height,width;
-   png_structp png_ptr;
-   png_infop info_ptr;
    static png_byte **img;
    static int is_allocated = FALSE;
    static png_byte **imgrgb;
@@ -39,18 +319,18 @@ int write_png (const char *outfile, const int nx, const int ny,
 
    // allocate the space for the special array
    if (!is_allocated && !three_channel) {
+      const int tag = mem_set_tag(MEM_ENCODE_ROWS);
       img = allocate_2d_array_pb(nx,ny,bit_depth);
+      mem_set_tag(tag);
       is_allocated = TRUE;
    }
    if (!rgb_is_allocated && three_channel) {
+      const int tag = mem_set_tag(MEM_ENCODE_ROWS);
       imgrgb = allocate_2d_rgb_array_pb(nx,ny,bit_depth);
+      mem_set_tag(tag);
       rgb_is_allocated = TRUE;
    }
 
-   // set the sizes in png-understandable format
-   height=ny;
-   width=nx;
-
    // auto-set the ranges
    if (autorange) {
 
@@ -107,185 +387,62 @@ int write_png (const char *outfile, const int nx, const int ny,
       printf("  output range %g %g\n",newminrange,newmaxrange);
    }
 
-   // write the file
-   fp = fopen(outfile,"wb");
-   if (fp==NULL) {
-      fprintf(stderr,"Could not open output file %s\n",outfile);
-      fflush(stderr);
-      exit(0);
+   // monochrome images share the buffered writer
+   if (!three_channel) {
+      return write_png_gray(outfile, nx, ny, high_depth, red, redmin, redrange, img, -1);
    }
 
-   // now do the other two channels
-   if (three_channel) {
-
-     // no scaling, 16-bit per channel, RGB
-     if (high_depth) {
-       // am I looping these coordinates in the right memory order?
-       for (j=ny-1; j>=0; j--) {
-         for (i=0; i<nx; i++) {
-           // red
-           printval = (int)(0.5 + 65535*(red[i][j]-redmin)/redrange);
-           if (printval<0) printval = 0;
-           else if (printval>65535) printval = 65535;
-           imgrgb[ny-1-j][6*i] = (png_byte)(printval/256);
-           imgrgb[ny-1-j][6*i+1] = (png_byte)(printval%256);
-           // green
-           printval = (int)(0.5 + 65535*(grn[i][j]-grnmin)/grnrange);
-           if (printval<0) printval = 0;
-           else if (printval>65535) printval = 65535;
-           imgrgb[ny-1-j][6*i+2] = (png_byte)(printval/256);
-           imgrgb[ny-1-j][6*i+3] = (png_byte)(printval%256);
-           // blue
-           printval = (int)(0.5 + 65535*(blu[i][j]-blumin)/blurange);
-           if (printval<0) printval = 0;
-           else if (printval>65535) printval = 65535;
-           imgrgb[ny-1-j][6*i+4] = (png_byte)(printval/256);
-           imgrgb[ny-1-j][6*i+5] = (png_byte)(printval%256);
-         }
-       }
-
-     // no scaling, 8-bit per channel, RGB
-     } else {
-       // am I looping these coordinates in the right memory order?
-       for (j=ny-1; j>=0; j--) {
-         for (i=0; i<nx; i++) {
-           // red
-           printval = (int)(0.5 + 256*(red[i][j]-redmin)/redrange);
-           if (printval<0) printval = 0;
-           else if (printval>255) printval = 255;
-           imgrgb[ny-1-j][3*i] = (png_byte)printval;
-           // green
-           printval = (int)(0.5 + 256*(grn[i][j]-grnmin)/grnrange);
-           if (printval<0) printval = 0;
-           else if (printval>255) printval = 255;
-           imgrgb[ny-1-j][3*i+1] = (png_byte)printval;
-           // blue
-           printval = (int)(0.5 + 256*(blu[i][j]-blumin)/blurange);
-           if (printval<0) printval = 0;
-           else if (printval>255) printval = 255;
-           imgrgb[ny-1-j][3*i+2] = (png_byte)printval;
-         }
+   // no scaling, 16-bit per channel, RGB
+   if (high_depth) {
+     // am I looping these coordinates in the right memory order?
+     for (j=ny-1; j>=0; j--) {
+       for (i=0; i<nx; i++) {
+         // red
+         printval = (int)(0.5 + 65535*(red[i][j]-redmin)/redrange);
+         if (printval<0) printval = 0;
+         else if (printval>65535) printval = 65535;
+         imgrgb[ny-1-j][6*i] = (png_byte)(printval/256);
+         imgrgb[ny-1-j][6*i+1] = (png_byte)(printval%256);
+         // green
+         printval = (int)(0.5 + 65535*(grn[i][j]-grnmin)/grnrange);
+         if (printval<0) printval = 0;
+         else if (printval>65535) printval = 65535;
+         imgrgb[ny-1-j][6*i+2] = (png_byte)(printval/256);
+         imgrgb[ny-1-j][6*i+3] = (png_byte)(printval%256);
+         // blue
+         printval = (int)(0.5 + 65535*(blu[i][j]-blumin)/blurange);
+         if (printval<0) printval = 0;
+         else if (printval>65535) printval = 65535;
+         imgrgb[ny-1-j][6*i+4] = (png_byte)(printval/256);
+         imgrgb[ny-1-j][6*i+5] = (png_byte)(printval%256);
        }
      }
 
-   // monochrome image, read data from red array
+   // no scaling, 8-bit per channel, RGB
    } else {
-
-     // no scaling, 16-bit per channel
-     if (high_depth) {
-       // am I looping these coordinates in the right memory order?
-       for (j=ny-1; j>=0; j--) {
-         for (i=0; i<nx; i++) {
-           printval = (int)(0.5 + 65534*(red[i][j]-redmin)/redrange);
-           if (printval<0) printval = 0;
-           else if (printval>65535) printval = 65535;
-           img[ny-1-j][2*i] = (png_byte)(printval/256);
-           img[ny-1-j][2*i+1] = (png_byte)(printval%256);
-         }
-       }
-
-     // no scaling, 8-bit per channel
-     } else {
-       // am I looping these coordinates in the right memory order?
-       for (j=ny-1; j>=0; j--) {
-         for (i=0; i<nx; i++) {
-           printval = (int)(0.5 + 254*(red[i][j]-redmin)/redrange);
-           if (printval<0) printval = 0;
-           else if (printval>255) printval = 255;
-           img[ny-1-j][i] = (png_byte)printval;
-         }
+     // am I looping these coordinates in the right memory order?
+     for (j=ny-1; j>=0; j--) {
+       for (i=0; i<nx; i++) {
+         // red
+         printval = (int)(0.5 + 256*(red[i][j]-redmin)/redrange);
+         if (printval<0) printval = 0;
+         else if (printval>255) printval = 255;
+         imgrgb[ny-1-j][3*i] = (png_byte)printval;
+         // green
+         printval = (int)(0.5 + 256*(grn[i][j]-grnmin)/grnrange);
+         if (printval<0) printval = 0;
+         else if (printval>255) printval = 255;
+         imgrgb[ny-1-j][3*i+1] = (png_byte)printval;
+         // blue
+         printval = (int)(0.5 + 256*(blu[i][j]-blumin)/blurange);
+         if (printval<0) printval = 0;
+         else if (printval>255) printval = 255;
+         imgrgb[ny-1-j][3*i+2] = (png_byte)printval;
        }
      }
-
-   }
-
-   /* Create and initialize the png_struct with the desired error handler
-    * functions.  If you want to use the default stderr and longjump method,
-    * you can supply NULL for the last three parameters.  We also check that
-    * the library version is compatible with the one used at compile time,
-    * in case we are using dynamically linked libraries.  REQUIRED.
-    */
-   png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-      NULL, NULL, NULL);
-
-   if (png_ptr == NULL) {
-      fclose(fp);
-      fprintf(stderr,"Could not create png struct\n");
-      fflush(stderr);
-      exit(0);
-      return (-1);
-   }
-
-   /* Allocate/initialize the image information data.  REQUIRED */
-   info_ptr = png_create_info_struct(png_ptr);
-   if (info_ptr == NULL) {
-      fclose(fp);
-      png_destroy_write_struct(&png_ptr,(png_infopp)NULL);
-      return (-1);
-   }
-
-   /* Set error handling.  REQUIRED if you aren't supplying your own
-    * error handling functions in the png_create_write_struct() call.
-    */
-   if (setjmp(png_jmpbuf(png_ptr))) {
-      /* If we get here, we had a problem reading the file */
-      fclose(fp);
-      png_destroy_write_struct(&png_ptr, &info_ptr);
-      return (-1);
-   }
-
-   /* set up the output control if you are using standard C streams */
-   png_init_io(png_ptr, fp);
-
-   /* Set the image information here.  Width and height are up to 2^31,
-    * bit_depth is one of 1, 2, 4, 8, or 16, but valid values also depend on
-    * the color_type selected. color_type is one of PNG_COLOR_TYPE_GRAY,
-    * PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_PALETTE, PNG_COLOR_TYPE_RGB,
-    * or PNG_COLOR_TYPE_RGB_ALPHA.  interlace is either PNG_INTERLACE_NONE or
-    * PNG_INTERLACE_ADAM7, and the compression_type and filter_type MUST
-    * currently be PNG_COMPRESSION_TYPE_BASE and PNG_FILTER_TYPE_BASE. REQUIRED
-    */
-   // png_set_IHDR(png_ptr, info_ptr, height, width, bit_depth,
-   if (three_channel) {
-      png_set_IHDR(png_ptr, info_ptr, width, height, bit_depth,
-         PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
-         PNG_FILTER_TYPE_BASE);
-   } else {
-      png_set_IHDR(png_ptr, info_ptr, width, height, bit_depth,
-         PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
-         PNG_FILTER_TYPE_BASE);
-   }
-
-   /* Optional gamma chunk is strongly suggested if you have any guess
-    * as to the correct gamma of the image. */
-   //png_set_gAMA(png_ptr, info_ptr, 2.2);
-   png_set_gAMA(png_ptr, info_ptr, gamma);
-
-   /* Write the file header information.  REQUIRED */
-   png_write_info(png_ptr, info_ptr);
-
-   /* One of the following output methods is REQUIRED */
-   // png_write_image(png_ptr, row_pointers);
-   if (three_channel) {
-      png_write_image(png_ptr, imgrgb);
-   } else {
-      png_write_image(png_ptr, img);
    }
 
-   /* It is REQUIRED to call this to finish writing the rest of the file */
-   png_write_end(png_ptr, info_ptr);
-
-   /* clean up after the write, and free any memory allocated */
-   png_destroy_write_struct(&png_ptr, &info_ptr);
-
-   // close file
-   fclose(fp);
-
-   // free the data array
-   //free_2d_array_pb(img);
-   //free_2d_array_pb(imgrgb);
-
-   return(0);
+   return write_png_rows(outfile, nx, ny, bit_depth, PNG_COLOR_TYPE_RGB, -1, imgrgb);
 }
 
 
@@ -389,7 +546,7 @@ int read_png (const char *infile, const int _nx, const int _ny,
    int ny = _ny;
    int high_depth;
    int three_channel;
-   int i,j,printval; //,bit_depth,color_type,interlace_type;
+   int i,j,printval,tag; //,bit_depth,color_type,interlace_type;
    float newminrange,newmaxrange;
    float overlay_divisor;
    FILE *fp;
@@ -491,8 +648,10 @@ int read_png (const char *infile, const int _nx, const int _ny,
    /* Optional call to gamma correct and add the background to the palette
     * and update info structure.  REQUIRED if you are expecting libpng to
     * update the palette for you (ie you selected such a transform above).
+    * Also needed so that 1-, 2- and 4-bit gray reads back as 8-bit below.
     */
-   //png_read_update_info(png_ptr, info_ptr);
+   png_read_update_info(png_ptr, info_ptr);
+   bit_depth = png_get_bit_depth(png_ptr, info_ptr);
 
    // check image type for applicability
    if (bit_depth != 8 && bit_depth != 16) {
@@ -545,11 +704,13 @@ int read_png (const char *infile, const int _nx, const int _ny,
    nx = width;
 
    // allocate the space for the image array
+   tag = mem_set_tag(MEM_PNG_ROWS);
    if (three_channel) {
       img = allocate_2d_rgb_array_pb(nx,ny,bit_depth);
    } else {
       img = allocate_2d_array_pb(nx,ny,bit_depth);
    }
+   mem_set_tag(tag);
 
    /* Now it's time to read the image.  One of these methods is REQUIRED */
    png_read_image(png_ptr, img);
@@ -672,18 +833,340 @@ int read_png (const char *infile, const int _nx, const int _ny,
 }
 
 
+/*
+ * decode packed 24-bit rgb elevations: both Terrain-RGB and Terrarium
+ * are affine in v = R*65536 + G*256 + B, so one kernel does both
+ *
+ * a plain loop over restrict pointers, which the vectorizer turns into
+ * byte shuffles and int-to-float converts in the avx2/sse4.1 clones
+ */
+SIMD_CLONES
+static void decode_packed_rgb (const png_byte *restrict rgb, const int n,
+   const float scale, const float offset, float *restrict out) {
+
+   int i;
+   for (i=0; i<n; i++) {
+      const int v = (rgb[3*i] << 16) | (rgb[3*i+1] << 8) | rgb[3*i+2];
+      out[i] = offset + scale*(float)v;
+   }
+}
+
+
+/*
+ * convert one decoded row of an 8- or 16-bit gray PNG to redmin +
+ * redrange*fraction, the same fractions read_png makes
+ */
+void convert_png_gray_row (const png_byte *buf, const int nx, const int bit_depth,
+   const float redmin, const float redrange, float *vals) {
+
+   int i;
+   if (bit_depth == 16) {
+      for (i=0; i<nx; i++) vals[i] = redmin+redrange*(buf[2*i]*256+buf[2*i+1])/65534.;
+   } else {
+      for (i=0; i<nx; i++) vals[i] = redmin+redrange*buf[i]/254.;
+   }
+}
+
+
+/*
+ * the try_ readers hand libpng's errors here rather than to its default
+ * handler: keep the message and jump back to the reader's setjmp
+ */
+struct png_error_buf {
+   const char *file;
+   char *msg;
+   size_t len;
+};
+
+static void keep_png_error (png_structp png_ptr, png_const_charp msg) {
+   struct png_error_buf *eb = (struct png_error_buf *)png_get_error_ptr(png_ptr);
+   snprintf(eb->msg, eb->len, "could not read %s: %s", eb->file, msg);
+   png_longjmp(png_ptr, 1);
+}
+
+// open infile and check its signature, or say why not
+static FILE* open_png (const char *infile, char *err, const size_t errlen) {
+   FILE *fp;
+   unsigned char header[8];
+
+   fp = fopen(infile,"rb");
+   if (fp==NULL) {
+      snprintf(err, errlen, "could not open %s", infile);
+      return(NULL);
+   }
+   if (fread(header, 1, 8, fp) != 8 || png_sig_cmp(header, 0, 8)) {
+      snprintf(err, errlen, "%s is not a png", infile);
+      fclose(fp);
+      return(NULL);
+   }
+   return(fp);
+}
+
+
+/*
+ * like read_png_res, but return nonzero with a message in err instead of
+ * exiting when the file can not be read
+ */
+int try_read_png_res (const char *infile, int *hgt, int *wdt, char *err, const size_t errlen) {
+
+   FILE *fp;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   struct png_error_buf eb;
+
+   fp = open_png(infile, err, errlen);
+   if (fp==NULL) return(1);
+
+   eb.file = infile;
+   eb.msg = err;
+   eb.len = errlen;
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, &eb, keep_png_error, NULL);
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL) {
+      snprintf(err, errlen, "could not read %s: out of memory", infile);
+      png_destroy_read_struct(&png_ptr, png_infopp_NULL, png_infopp_NULL);
+      fclose(fp);
+      return(1);
+   }
+   if (setjmp(png_jmpbuf(png_ptr))) {
+      png_destroy_read_struct(&png_ptr, &info_ptr, png_infopp_NULL);
+      fclose(fp);
+      return(1);
+   }
+
+   png_init_io(png_ptr, fp);
+   png_set_sig_bytes(png_ptr, 8);
+   png_read_info(png_ptr, info_ptr);
+   (*hgt) = png_get_image_height(png_ptr, info_ptr);
+   (*wdt) = png_get_image_width(png_ptr, info_ptr);
+
+   png_destroy_read_struct(&png_ptr, &info_ptr, png_infopp_NULL);
+   fclose(fp);
+   return(0);
+}
+
+
+/*
+ * read a PNG one row at a time, handing each converted row to a callback,
+ * so that images larger than memory never need a full buffer
+ *
+ * ENCODING_GRAY reads 1-channel 8- or 16-bit images as fractions, like
+ * read_png; the rgb encodings read 8-bit RGB(A) images as meters; either
+ * way the callback sees redmin + redrange*value
+ *
+ * the callback gets the dem column index j (0 at the bottom, as in
+ * read_png) and nx floats; returning a positive value stops the read,
+ * and that value is returned
+ *
+ * a file that can not be opened, is not a usable png, or is corrupt or
+ * truncated anywhere returns -1 with a message in err, so that a long
+ * running caller can carry on
+ */
+int try_read_png_rows (const char *infile, const int nx, const int ny,
+   const int encoding, float redmin, float redrange,
+   int (*rowfunc)(void*, const int, const float*), void *ctx,
+   char *err, const size_t errlen) {
+
+   int row,retval,tag;
+   FILE *fp;
+   png_uint_32 height,width;
+   int bit_depth,color_type,interlace_type;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   // set after the setjmp and freed after a longjmp, so volatile
+   png_byte *volatile buf = NULL;
+   float *volatile vals = NULL;
+   float scale,offset;
+   char msg[256];
+   struct png_error_buf eb;
+
+   fp = open_png(infile, err, errlen);
+   if (fp==NULL) return(-1);
+
+   eb.file = infile;
+   eb.msg = err;
+   eb.len = errlen;
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, &eb, keep_png_error, NULL);
+   info_ptr = png_create_info_struct(png_ptr);
+   if (info_ptr == NULL) {
+      snprintf(err, errlen, "could not read %s: out of memory", infile);
+      png_destroy_read_struct(&png_ptr, png_infopp_NULL, png_infopp_NULL);
+      fclose(fp);
+      return(-1);
+   }
+   if (setjmp(png_jmpbuf(png_ptr))) {
+      png_destroy_read_struct(&png_ptr, &info_ptr, png_infopp_NULL);
+      fclose(fp);
+      if (buf) mem_free(buf);
+      if (vals) mem_free(vals);
+      return(-1);
+   }
+
+   png_init_io(png_ptr, fp);
+   png_set_sig_bytes(png_ptr, 8);
+   png_read_info(png_ptr, info_ptr);
+
+   png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
+       &interlace_type, int_p_NULL, int_p_NULL);
+
+   png_set_packing(png_ptr);
+   if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+      png_set_expand_gray_1_2_4_to_8(png_ptr);
+
+   // rgb encodings are often stored with an alpha channel or a palette
+   if (encoding != ENCODING_GRAY) {
+      if (color_type == PNG_COLOR_TYPE_PALETTE) {
+         png_set_palette_to_rgb(png_ptr);
+         color_type = PNG_COLOR_TYPE_RGB;
+      }
+      if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
+         png_set_strip_alpha(png_ptr);
+         color_type = PNG_COLOR_TYPE_RGB;
+      }
+   }
+   // check the depth after the transforms, so 1-, 2- and 4-bit gray is 8-bit
+   png_read_update_info(png_ptr, info_ptr);
+   bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+
+   // check image type for applicability; png_error lands in the setjmp above
+   if (encoding == ENCODING_GRAY) {
+     if (bit_depth != 8 && bit_depth != 16) {
+       snprintf(msg, sizeof(msg), "expected an 8-bit or 16-bit image, not %d-bit", bit_depth);
+       png_error(png_ptr, msg);
+     }
+     if (color_type != PNG_COLOR_TYPE_GRAY) {
+       png_error(png_ptr, "expected a 1-channel PNG; convert it to grayscale or give an rgb encoding");
+     }
+   } else {
+     if (bit_depth != 8 || color_type != PNG_COLOR_TYPE_RGB) {
+       snprintf(msg, sizeof(msg), "rgb-encoded elevations need an 8-bit RGB PNG, not bit_depth %d, color_type %d",
+                bit_depth, color_type);
+       png_error(png_ptr, msg);
+     }
+   }
+   if (interlace_type != PNG_INTERLACE_NONE) {
+     png_error(png_ptr, "interlaced PNGs can not be streamed");
+   }
+   if (ny != height || nx != width) {
+     snprintf(msg, sizeof(msg), "expected %d x %d, image is %d x %d", nx, ny, (int)width, (int)height);
+     png_error(png_ptr, msg);
+   }
+
+   // fold the encoding and the caller's scaling into one multiply-add
+   if (encoding == ENCODING_TERRAIN_RGB) {
+      // h = -10000 + 0.1 * (R*65536 + G*256 + B)
+      scale = redrange * 0.1f;
+      offset = redmin - redrange * 10000.f;
+   } else if (encoding == ENCODING_TERRARIUM) {
+      // h = R*256 + G + B/256 - 32768
+      scale = redrange / 256.f;
+      offset = redmin - redrange * 32768.f;
+   } else {
+      scale = redrange;
+      offset = redmin;
+   }
+
+   tag = mem_set_tag(MEM_PNG_ROWS);
+   buf = (png_byte *)mem_alloc(png_get_rowbytes(png_ptr, info_ptr));
+   vals = (float *)mem_alloc((size_t)nx * sizeof(float));
+   mem_set_tag(tag);
+
+   // png rows run top to bottom, dem rows bottom to top
+   retval = 0;
+   for (row=0; row<ny && retval==0; row++) {
+      png_read_row(png_ptr, buf, NULL);
+      if (encoding != ENCODING_GRAY) {
+         decode_packed_rgb(buf, nx, scale, offset, vals);
+      } else {
+         convert_png_gray_row(buf, nx, bit_depth, redmin, redrange, vals);
+      }
+      retval = rowfunc(ctx, ny-1-row, vals);
+   }
+
+   // a callback may stop early, in which case skip png_read_end
+   if (retval == 0) png_read_end(png_ptr, info_ptr);
+   png_destroy_read_struct(&png_ptr, &info_ptr, png_infopp_NULL);
+   fclose(fp);
+
+   mem_free(buf);
+   mem_free(vals);
+
+   return(retval);
+}
+
+/*
+ * try_read_png_rows for the command line: any problem ends the program
+ */
+int read_png_rows (const char *infile, const int nx, const int ny,
+   const int encoding, float redmin, float redrange,
+   int (*rowfunc)(void*, const int, const float*), void *ctx) {
+
+   char err[512];
+   const int retval = try_read_png_rows(infile, nx, ny, encoding, redmin, redrange,
+                                        rowfunc, ctx, err, sizeof(err));
+   if (retval < 0) {
+      fprintf(stderr,"%s\n",err);
+      fflush(stderr);
+      exit(0);
+   }
+   return(retval);
+}
+
+
+/*
+ * read a PNG row by row into one float array, in any encoding
+ */
+struct column_store {
+   float **red;
+   int nx;
+};
+
+static int store_column_row (void *ctx, const int j, const float *vals) {
+   struct column_store *cs = (struct column_store *)ctx;
+   int i;
+   // red is indexed [x][y], so this is a strided write
+   for (i=0; i<cs->nx; i++) cs->red[i][j] = vals[i];
+   return(0);
+}
+
+int read_png_encoded (const char *infile, const int nx, const int ny,
+   const int encoding, float **red, float redmin, float redrange) {
+
+   struct column_store cs;
+   cs.red = red;
+   cs.nx = nx;
+   return(read_png_rows(infile, nx, ny, encoding, redmin, redrange, store_column_row, &cs));
+}
+
+int try_read_png_encoded (const char *infile, const int nx, const int ny,
+   const int encoding, float **red, float redmin, float redrange,
+   char *err, const size_t errlen) {
+
+   struct column_store cs;
+   cs.red = red;
+   cs.nx = nx;
+   return(try_read_png_rows(infile, nx, ny, encoding, redmin, redrange, store_column_row, &cs,
+                            err, errlen));
+}
+
+
 /*
  * allocate memory for a two-dimensional array of png_byte
  */
-png_byte** allocate_2d_array_pb(const int nx, const int ny, const int depth) {
+png_byte** allocate_2d_array_pb(const size_t nx, const size_t ny, const int depth) {
 
-   int i,bytesperpixel;
+   size_t i,bytesperpixel;
    png_byte **array;
 
    if (depth <= 8) bytesperpixel = 1;
    else bytesperpixel = 2;
-   array = (png_byte **)malloc(ny * sizeof(png_byte *));
-   array[0] = (png_byte *)malloc(bytesperpixel * nx * ny * sizeof(png_byte));
+   array = (png_byte **)mem_alloc(ny * sizeof(png_byte *));
+   array[0] = (png_byte *)mem_alloc(bytesperpixel * nx * ny * sizeof(png_byte));
+   if (array[0] == NULL) {
+      fprintf(stderr,"Could not allocate %zu x %zu png image\n",nx,ny);
+      fflush(stderr);
+      exit(1);
+   }
 
    for (i=1; i<ny; i++)
       array[i] = array[0] + i * bytesperpixel * nx;
@@ -691,15 +1174,20 @@ png_byte** allocate_2d_array_pb(const int nx, const int ny, const int depth) {
    return(array);
 }
 
-png_byte** allocate_2d_rgb_array_pb(const int nx, const int ny, const int depth) {
+png_byte** allocate_2d_rgb_array_pb(const size_t nx, const size_t ny, const int depth) {
 
-   int i,bytesperpixel;
+   size_t i,bytesperpixel;
    png_byte **array;
 
    if (depth <= 8) bytesperpixel = 3;
    else bytesperpixel = 6;
-   array = (png_byte **)malloc(ny * sizeof(png_byte *));
-   array[0] = (png_byte *)malloc(bytesperpixel * nx * ny * sizeof(png_byte));
+   array = (png_byte **)mem_alloc(ny * sizeof(png_byte *));
+   array[0] = (png_byte *)mem_alloc(bytesperpixel * nx * ny * sizeof(png_byte));
+   if (array[0] == NULL) {
+      fprintf(stderr,"Could not allocate %zu x %zu png image\n",nx,ny);
+      fflush(stderr);
+      exit(1);
+   }
 
    for (i=1; i<ny; i++)
       array[i] = array[0] + i * bytesperpixel * nx;
@@ -708,8 +1196,8 @@ png_byte** allocate_2d_rgb_array_pb(const int nx, const int ny, const int depth)
 }
 
 int free_2d_array_pb(png_byte** array){
-   free(array[0]);
-   free(array);
+   mem_free(array[0]);
+   mem_free(array);
    return(0);
 }
 
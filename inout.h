@@ -14,15 +14,31 @@ extern "C" {
 #define TRUE 1
 #define MAXCHARS 255
 
+// how pixel values map to elevations in read_png_rows
+#define ENCODING_GRAY 0
+#define ENCODING_TERRAIN_RGB 1
+#define ENCODING_TERRARIUM 2
+
 #define png_infopp_NULL (png_infopp)NULL
 #define int_p_NULL (int*)NULL
 #include "png.h"
 
 int write_png (const char*, const int, const int, const int, const int, float**, float, float, float**, float, float, float**, float, float);
+int write_png_rows (const char*, const int, const int, const int, const int, const int, png_byte**);
+int write_png_rows_fn (const char*, const int, const int, const int, const int, const int, void (*)(void*, const int, png_byte*), void*);
+int write_png_rows_mem (const int, const int, const int, const int, const int, png_byte**, png_byte**, size_t*);
+void quantize_png_gray (const int, const int, const int, float**, float, float, png_byte**);
+int write_png_gray (const char*, const int, const int, const int, float**, float, float, png_byte**, const int);
 int read_png_res (const char *infile, int *hgt, int *wdt);
 int read_png (const char*, const int, const int, const int, const int, const float, const int, float**, float, float, float**, float, float, float**, float, float);
-png_byte** allocate_2d_array_pb (const int,const int,const int);
-png_byte** allocate_2d_rgb_array_pb (const int,const int,const int);
+int read_png_rows (const char*, const int, const int, const int, float, float, int (*)(void*, const int, const float*), void*);
+void convert_png_gray_row (const png_byte*, const int, const int, const float, const float, float*);
+int read_png_encoded (const char*, const int, const int, const int, float**, float, float);
+int try_read_png_res (const char*, int*, int*, char*, const size_t);
+int try_read_png_rows (const char*, const int, const int, const int, float, float, int (*)(void*, const int, const float*), void*, char*, const size_t);
+int try_read_png_encoded (const char*, const int, const int, const int, float**, float, float, char*, const size_t);
+png_byte** allocate_2d_array_pb (const size_t,const size_t,const int);
+png_byte** allocate_2d_rgb_array_pb (const size_t,const size_t,const int);
 int free_2d_array_pb (png_byte**);
 
 #ifdef __cplusplus
@@ -0,0 +1,44 @@
+//
+// los.cpp - line of sight along a profile
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "los.h"
+
+#include <iostream>
+#include <cstdio>
+
+void line_of_sight(const float* profile, const size_t ox, const float eye,
+                   unsigned char* visible) {
+  if (ox == 0) return;
+  const float z0 = profile[0] + eye;
+  visible[0] = 1;
+
+  // slopes are in profile units per station; the true scale of either
+  // axis would not change which is steeper
+  float best = -1.e+30f;
+  for (size_t i=1; i<ox; ++i) {
+    const float slope = (profile[i] - z0) / i;
+    visible[i] = (slope >= best);
+    if (slope > best) best = slope;
+  }
+}
+
+void write_los_intervals(const std::string& filename, const unsigned char* visible,
+                         const size_t ox, const float len) {
+  FILE* fp = fopen(filename.c_str(), "w");
+  if (!fp) {
+    std::cerr << "Could not open line of sight file " << filename << "\n";
+    return;
+  }
+  fprintf(fp, "# state from to, in dem cells along the line\n");
+  size_t start = 0;
+  for (size_t i=1; i<=ox; ++i) {
+    if (i < ox && visible[i] == visible[start]) continue;
+    fprintf(fp, "%s %g %g\n", visible[start] ? "visible" : "hidden",
+            len*start/ox, len*i/ox);
+    start = i;
+  }
+  fclose(fp);
+}
@@ -0,0 +1,23 @@
+//
+// los.h - line of sight along a profile
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// mark which of the ox stations of a profile can be seen from an eye
+// eye units above station 0, in one pass keeping the steepest sight line
+// so far; station i is visible when nothing before it rises above the
+// straight line from the eye to it
+void line_of_sight(const float* profile, const size_t ox, const float eye,
+                   unsigned char* visible);
+
+// write runs of visible and hidden stations as "visible|hidden from to",
+// with from and to in dem cells along the line of length len
+void write_los_intervals(const std::string& filename, const unsigned char* visible,
+                         const size_t ox, const float len);
@@ -6,69 +6,33 @@
 
 #include "memory.h"
 #include "inout.h"
+#include "dem.h"
+#include "mosaic.h"
+#include "xyz.h"
+#include "pyramid.h"
+#include "profile.h"
+#include "render.h"
+#include "swath.h"
+#include "path.h"
+#include "frames.h"
+#include "horizon.h"
+#include "los.h"
+#include "viewshed.h"
+#include "perspective.h"
+#include "density.h"
+#include "strip.h"
+#include "serve.h"
+#include "timings.h"
+#include "trace.h"
+#include "parallel.h"
 #include "CLI11.hpp"
 
 #include <cassert>
 #include <iostream>
 #include <string>
 #include <cmath>
-
-constexpr double pi() { return std::atan(1)*4; }
-
-// finding intersection points of a point-angle combination with the box boundaries
-
-void findIntersection(const float px, const float py, const float alpha,
-                      const float nx, const float ny,
-                      float& x_intersect, float& y_intersect) {
-
-  const float alpharad = std::fmod(alpha, 360.f) * pi() / 180.0;
-
-  // Check intersection with the right boundary
-  if (alpharad < pi() / 2 || alpharad > 3 * pi() / 2) {
-    x_intersect = nx;
-    y_intersect = py + std::tan(alpharad) * (nx - px);
-    //printf("  right bdry, testing %g %g\n", x_intersect, y_intersect);
-    if (y_intersect >= 0 && y_intersect <= ny) {
-      return;
-    }
-  } 
-
-  // Check intersection with the left boundary
-  if (alpharad > pi() / 2 && alpharad < 3 * pi() / 2) {
-    x_intersect = 0;
-    y_intersect = py - std::tan(alpharad) * px;
-    //printf("  left bdry, testing %g %g\n", x_intersect, y_intersect);
-    if (y_intersect >= 0 && y_intersect <= ny) {
-      return;
-    }
-  }
-
-  // Check intersection with the top boundary
-  if (alpharad > 0 && alpharad < pi()) {
-    y_intersect = ny;
-    x_intersect = px + (ny - py) / std::tan(alpharad);
-    //printf("  top bdry, testing %g %g\n", x_intersect, y_intersect);
-    if (x_intersect >= 0 && x_intersect <= nx) {
-      return;
-    }
-  }
-
-  // Check intersection with the bottom boundary
-  if (alpharad > pi() && alpharad < 2 * pi()) {
-    y_intersect = 0;
-    x_intersect = px - py / std::tan(alpharad);
-    //printf("  bottom bdry, testing %g %g\n", x_intersect, y_intersect);
-    if (x_intersect >= 0 && x_intersect <= nx) {
-      return;
-    }
-  }
-
-  // If no intersection is found, return the original point (this should not happen with valid inputs)
-  x_intersect = px;
-  y_intersect = py;
-  return;
-}
-
+#include <algorithm>
+#include <fstream>
 
 // begin execution here
 
@@ -82,6 +46,18 @@ int main(int argc, char const *argv[]) {
   // load a dem from a png file - check command line for file name
   std::string demfile = "in.png";
   app.add_option("-i,--input", demfile, "png DEM for elevations");
+  std::string mosaicfile;
+  app.add_option("-m,--mosaic", mosaicfile, "text manifest of png DEM tiles (path xoff yoff) to use instead of one input");
+  std::string xyzdir;
+  app.add_option("--xyz", xyzdir, "directory of z/x/y.png DEM tiles to use instead of one input");
+  std::string encoding = "gray";
+  app.add_option("--encoding", encoding, "how png pixels hold elevations: gray (default), terrain-rgb, terrarium");
+  std::vector<float> elevrange = {0.f, 9000.f};
+  app.add_option("--elev-range", elevrange, "meters shown at the bottom and top of the output for rgb encodings, and the vertical scale of the eye for every encoding, default 0,9000")->expected(2)->delimiter(',');
+  std::vector<float> grayrange;
+  app.add_option("--gray-range", grayrange, "meters that the darkest and brightest gray levels stand for, for the eye and vertical scale of --los, --viewshed, --horizon and --perspective, default --elev-range")->expected(2)->delimiter(',');
+  std::vector<double> bounds;
+  app.add_option("--bounds", bounds, "region of the tile pyramid as west,south,east,north degrees")->expected(4)->delimiter(',');
 
   // set output file name and size
   std::string outfile = "out.png";
@@ -98,6 +74,112 @@ int main(int argc, char const *argv[]) {
   app.add_option("--py", py, "vertical position of line datum, 0..1, default 0.5 (center)");
   float alpha = 0.0;
   app.add_option("-a,--angle", alpha, "angle of line, degrees, 0=180=horizontal=default");
+  std::string sweep;
+  app.add_option("--sweep", sweep, "write one numbered frame per angle in start:end:step degrees, e.g. 0:359:1");
+  std::string pathfile;
+  app.add_option("--path", pathfile, "file of x y pixel vertices to follow instead of a straight line");
+
+  // swath profiles
+  float swathwidth = 0.f;
+  app.add_option("--swath-width", swathwidth, "reduce a band of parallel lines this many dem pixels wide to min/mean/max envelopes");
+  size_t swathlines = 21;
+  app.add_option("--swath-lines", swathlines, "number of parallel lines across the swath, default 21");
+  std::vector<float> swathpct = {25.f, 75.f};
+  app.add_option("--swath-pct", swathpct, "low and high percentiles shaded in the swath, default 25,75")->expected(2)->delimiter(',');
+
+  // horizon panoramas
+  bool horizon = false;
+  app.add_flag("--horizon", horizon, "draw the 360-degree skyline seen from the datum, starting at azimuth --angle");
+  float eyeheight = 2.f;
+  app.add_option("--eye-height", eyeheight, "observer's eye above the ground in meters, default 2");
+  float cellsize = 30.f;
+  app.add_option("--cell-size", cellsize, "dem pixel size in meters, default 30");
+  bool curvature = false;
+  app.add_flag("--curvature", curvature, "lower distant terrain for earth curvature and refraction");
+
+  // viewsheds
+  bool doviewshed = false;
+  app.add_flag("--viewshed", doviewshed, "write a dem-sized png of the cells visible from the datum instead of a profile");
+  size_t viewcheck = 0;
+  app.add_option("--viewshed-check", viewcheck, "compare the viewshed against direct ray casts to this many cells");
+
+  // perspective views
+  bool doperspective = false;
+  app.add_flag("--perspective", doperspective, "render the view from the datum looking along --angle instead of a profile");
+  float fov = 60.f;
+  app.add_option("--fov", fov, "horizontal field of view of --perspective, degrees, default 60");
+  float fardist = 0.f;
+  app.add_option("--far", fardist, "farthest terrain drawn, dem pixels, default is the dem diagonal");
+  float fogdist = 0.f;
+  app.add_option("--fog", fogdist, "distance in dem pixels where fog is 63% thick, default a third of --far");
+
+  // density plots
+  size_t densityn = 0;
+  app.add_option("--density", densityn, "accumulate this many jittered profiles into one density image");
+  float jitterangle = 5.f;
+  app.add_option("--jitter-angle", jitterangle, "largest change in --density line angles, degrees, default 5");
+  float jitteroffset = 10.f;
+  app.add_option("--jitter-offset", jitteroffset, "largest sideways shift of --density lines, dem pixels, default 10");
+  uint64_t seed = 1;
+  app.add_option("--seed", seed, "random seed for --density lines, default 1");
+
+  // corridor strips
+  float stripwidth = 0.f;
+  app.add_option("--strip", stripwidth, "write the dem under a corridor this many dem pixels wide, rotated to lie along the line, instead of a profile");
+
+  // line of sight
+  bool los = false;
+  app.add_flag("--los", los, "gray out ground hidden from an eye --eye-height above the start of the line");
+  std::string losfile;
+  app.add_option("--los-out", losfile, "write the visible and hidden stretches of the line to this text file");
+
+  // ridgeline plots
+  size_t stackn = 0;
+  app.add_option("--stack", stackn, "draw this many parallel profiles as a ridgeline plot");
+  float stackwidth = 0.f;
+  app.add_option("--stack-width", stackwidth, "dem pixels across the stacked lines, default is the whole dem");
+  float stackheight = 4.f;
+  app.add_option("--stack-height", stackheight, "relief of each stacked line in row spacings, default 4");
+
+  // filtering
+  bool usemip = false;
+  app.add_flag("--mip", usemip, "sample from a mip pyramid of the dem to avoid aliasing on long lines");
+  std::string mipcache;
+  app.add_option("--mip-cache", mipcache, "file to read the mip pyramid from, or save it to");
+  bool exact = false;
+  app.add_flag("--exact", exact, "sample every dem cell the line crosses, then average down to the output width");
+  std::string reduce;
+  app.add_option("--reduce", reduce, "use the max, min or mean of all dem cells under each output column");
+
+  // memory use
+  size_t memmb = 0;
+  app.add_option("--mem", memmb, "memory budget for the dem in MB, default 3/4 of physical memory");
+  size_t tilecachemb = 0;
+  app.add_option("--tile-cache", tilecachemb, "memory for decoded --xyz tiles in MB, default 1/4 of --mem");
+  bool outofcore = false;
+  app.add_flag("--out-of-core", outofcore, "page the dem from a scratch file even if it would fit in memory");
+  std::string scratchdir = "/tmp";
+  app.add_option("--scratch", scratchdir, "directory for the out-of-core scratch file");
+  size_t nthreads = 0;
+  app.add_option("-t,--threads", nthreads, "number of threads, default is all cores");
+
+  // daemon mode
+  std::string servesock;
+  app.add_option("--serve", servesock, "answer json profile requests on this unix socket, keeping dems in memory");
+  std::string servedir = "/tmp";
+  app.add_option("--serve-dir", servedir, "directory that --serve writes \"format\":\"path\" images to, default /tmp");
+
+  // instrumentation
+  bool showtimings = false;
+  app.add_flag("--timings", showtimings, "print the time, throughput and peak memory of each phase");
+  std::string timingsjson;
+  app.add_option("--timings-json", timingsjson, "append the timings as one json line to this file, - for stdout");
+  bool perfcounters = false;
+  bool memreport = false;
+  app.add_flag("--mem-report", memreport, "track current and peak bytes of each kind of buffer and print them at exit");
+  std::string tracefile;
+  app.add_option("--trace", tracefile, "write chrome trace events for each phase, line, frame and thread to this json file");
+  app.add_flag("--perf-counters", perfcounters, "count cycles, instructions and cache, tlb and branch misses in each phase; implies --timings");
 
   // finally parse
   try {
@@ -106,103 +188,516 @@ int main(int argc, char const *argv[]) {
     return app.exit(e);
   }
 
+  if (memreport) mem_track_enable();
+  if (!tracefile.empty()) trace_start(tracefile);
+  Timings timings;
+  std::unique_ptr<PerfCounters> counters;
+  if (perfcounters) {
+    showtimings = true;
+    counters.reset(new PerfCounters());
+    if (counters->available()) timings.use_counters(counters.get());
+    else std::cout << "  perf counters unavailable (" << counters->reason() << "), reporting times only\n";
+  }
+  auto report_timings = [&]() {
+    if (showtimings) timings.report(std::cout, false);
+    if (timingsjson == "-") {
+      timings.report(std::cout, true);
+    } else if (!timingsjson.empty()) {
+      std::ofstream os(timingsjson, std::ios::app);
+      timings.report(os, true);
+    }
+  };
+
 
   //
   // read a png of elevations
   //
 
-  std::cout << "Reading elevations from file (" << demfile << ")\n";
+  const size_t budget = memory_budget(memmb);
+  DemEncoding enc;
+  enc.encoding = DemEncoding::parse(encoding);
+  enc.lo = elevrange[0];
+  enc.hi = elevrange[1];
+  // gray dems are read as 0..1, and only the eye needs them in meters
+  const std::vector<float>& zrange = (enc.encoding == ENCODING_GRAY && !grayrange.empty()) ? grayrange : elevrange;
+  // both are divided by hi-lo, so an empty or inverted range is an error
+  if (!(elevrange[1] > elevrange[0])) {
+    std::cerr << "--elev-range needs lo,hi with hi above lo, not " << elevrange[0] << "," << elevrange[1] << "\n";
+    exit(0);
+  }
+  if (!grayrange.empty() && !(grayrange[1] > grayrange[0])) {
+    std::cerr << "--gray-range needs lo,hi with hi above lo, not " << grayrange[0] << "," << grayrange[1] << "\n";
+    exit(0);
+  }
+  if (!servesock.empty()) return serve(servesock, servedir, enc, budget, nthreads);
 
-  // check the resolution first
+  float** dem = nullptr;
+  std::unique_ptr<DemGrid> grid;
+  std::unique_ptr<XyzPyramid> pyramid;
+  XyzDem* xyzgrid = nullptr;
   size_t nx, ny;
-  {
-    int hgt, wdt;
-    (void) read_png_res (demfile.c_str(), &hgt, &wdt);
-    if (wdt > 0) nx = wdt;
-    if (hgt > 0) ny = hgt;
+
+  if (!xyzdir.empty()) {
+    std::cout << "Reading tile pyramid from (" << xyzdir << ")\n";
+    timings.begin("open");
+    pyramid.reset(new XyzPyramid(xyzdir, bounds));
+
+    // the line's length at the finest zoom sets the zoom we sample from
+    float lsx, lsy, lfx, lfy;
+    const float zx = pyramid->width(pyramid->zmax);
+    const float zy = pyramid->height(pyramid->zmax);
+    findIntersection(px*zx, py*zy, alpha+180.f, zx, zy, lsx, lsy);
+    findIntersection(px*zx, py*zy, alpha, zx, zy, lfx, lfy);
+    double linelen = std::hypot(lfx-lsx, lfy-lsy);
+    // path vertices are pixels at the finest zoom
+    if (!pathfile.empty()) linelen = read_path(pathfile, (int64_t)zy).length();
+    const int zoom = pyramid->zoom_for(linelen, ox);
+
+    // the rest of the budget is left for pyramids, profiles and images
+    const size_t tilebudget = tilecachemb > 0 ? (tilecachemb << 20) : budget / 4;
+    xyzgrid = new XyzDem(*pyramid, zoom, enc, tilebudget);
+    grid.reset(xyzgrid);
+    nx = grid->nx;
+    ny = grid->ny;
+    timings.end();
+
+  } else if (!mosaicfile.empty()) {
+    std::cout << "Reading tile list from file (" << mosaicfile << ")\n";
+    timings.begin("open");
+    grid.reset(new MosaicDem(MosaicDem::read_manifest(mosaicfile), enc, budget));
+    nx = grid->nx;
+    ny = grid->ny;
+    timings.end();
+
+  } else {
+    std::cout << "Reading elevations from file (" << demfile << ")\n";
+
+    // check the resolution first
+    {
+      int hgt, wdt;
+      timings.begin("header");
+      (void) read_png_res (demfile.c_str(), &hgt, &wdt);
+      if (wdt > 0) nx = wdt;
+      if (hgt > 0) ny = hgt;
+      timings.end();
+    }
+
+    // a full read needs the float grid plus the png image buffer, and a
+    // viewshed also keeps its byte mask
+    const size_t incorebytes = nx * ny * (sizeof(float) + 2 + (doviewshed ? 1 : 0));
+    if (incorebytes > budget) outofcore = true;
+    timings.begin("read");
+
+    if (outofcore) {
+      std::cout << "  dem needs " << (incorebytes>>20) << " MB, budget is " << (budget>>20) << " MB\n";
+      grid.reset(new PagedDem(demfile, nx, ny, enc, budget, scratchdir));
+    } else {
+      // allocate the space
+      const int tag = mem_set_tag(MEM_DEM);
+      dem = allocate_2d_array_f(nx, ny);
+      mem_set_tag(tag);
+
+      // read the elevations, scaled as 0..1
+      read_dem_png(demfile, nx, ny, enc, dem);
+      grid.reset(new InCoreDem(dem, nx, ny));
+    }
+    timings.end((double)nx*ny, "pix", Timings::file_bytes(demfile));
   }
 
-  // allocate the space
-  float** dem = allocate_2d_array_f((int)nx, (int)ny);
 
-  // read the first channel into the elevation array, scaled as 0..vscale
-  (void) read_png (demfile.c_str(), (int)nx, (int)ny, 0, 0, 0.0, 0,
-                   dem, 0.0, 1.0, nullptr, 0.0, 1.0, nullptr, 0.0, 1.0);
+  //
+  // or compute what the datum can see
+  //
+
+  if (doviewshed) {
+    Observer obs;
+    obs.x = px*nx;
+    obs.y = py*ny;
+    obs.height = eyeheight;
+    obs.cellsize = cellsize;
+    obs.zlo = zrange[0];
+    obs.zhi = zrange[1];
+    obs.curvature = curvature;
+    std::cout << "  viewshed from " << obs.x << " " << obs.y << ", " << eyeheight << " m up\n";
+
+    // the mask stays in memory even when the dem is paged
+    if (nx*ny > budget) {
+      std::cerr << "A viewshed needs " << ((nx*ny)>>20) << " MB for its mask, budget is "
+                << (budget>>20) << " MB; raise --mem\n";
+      exit(0);
+    }
 
+    timings.begin("viewshed");
+    unsigned char* vis = viewshed(*grid, obs, nthreads);
+    timings.end((double)nx*ny, "pix");
+    int status = 0;
+    if (viewcheck > 0) {
+      const double agree = viewshed_check(*grid, obs, viewcheck, nthreads, vis);
+      std::cout << "  " << 100.0*agree << "% of checked cells agree with direct ray casts\n";
+      // the sweep samples where rays pass, not at cell centers, so a
+      // few cells along sight-line edges may differ
+      if (agree < 0.98) status = 1;
+    }
+
+    grid.reset();
+    if (dem) free_2d_array_f(dem);
+
+    // one 8-bit row at a time, top row first, with visible cells at the
+    // 254 that write_png gave a 1
+    std::cout << "Writing viewshed to " << outfile << std::endl;
+    timings.begin("write");
+    struct MaskRows { const unsigned char* vis; size_t nx, ny; } mr = {vis, nx, ny};
+    (void) write_png_rows_fn (outfile.c_str(), (int)nx, (int)ny, 8, PNG_COLOR_TYPE_GRAY, -1,
+                              [](void* ctx, const int r, png_byte* row) {
+      const MaskRows& m = *(const MaskRows*)ctx;
+      const unsigned char* src = m.vis + (m.ny-1-r)*m.nx;
+      for (size_t i=0; i<m.nx; ++i) row[i] = src[i] ? 254 : 0;
+    }, &mr);
+    timings.end((double)nx*ny, "pix", Timings::file_bytes(outfile));
+    mem_free(vis);
+    report_timings();
+    return status;
+  }
+
+  if (doperspective) {
+    Camera cam;
+    cam.eye.x = px*nx;
+    cam.eye.y = py*ny;
+    cam.eye.height = eyeheight;
+    cam.eye.cellsize = cellsize;
+    cam.eye.zlo = zrange[0];
+    cam.eye.zhi = zrange[1];
+    cam.eye.curvature = curvature;
+    cam.fov = fov;
+    cam.far = fardist;
+    cam.fog = fogdist;
+    std::cout << "  camera at " << cam.eye.x << " " << cam.eye.y << ", " << eyeheight << " m up\n";
+
+    const std::string& source = !xyzdir.empty() ? xyzdir : (!mosaicfile.empty() ? mosaicfile : demfile);
+    timings.begin("pyramid");
+    DemPyramid view(*grid, REDUCE_MEAN, perspective_levels(*grid, cam, ox), mipcache, source, enc, budget, nthreads);
+    timings.end();
+    const int tag = mem_set_tag(MEM_PROFIMG);
+    float** img = allocate_2d_array_f(ox, oy);
+    mem_set_tag(tag);
+
+    if (sweep.empty()) {
+      cam.heading = alpha;
+      timings.begin("rasterize");
+      render_perspective(view, cam, ox, oy, nthreads, img);
+      timings.end((double)ox*oy, "pix");
+      std::cout << "Writing view to " << outfile << std::endl;
+      timings.begin("write");
+      (void) write_png (outfile.c_str(), (int)ox, (int)oy, FALSE, TRUE,
+                        img, 0.0, 1.0, nullptr, 0.0, 1.0, nullptr, 0.0, 1.0);
+      timings.end((double)ox*oy, "pix", Timings::file_bytes(outfile));
+    } else {
+      // each frame is already parallel over its columns
+      const std::vector<float> angles = parse_sweep(sweep);
+      const int btag = mem_set_tag(MEM_ENCODE_ROWS);
+      png_byte** buf = allocate_2d_array_pb(ox, oy, 16);
+      mem_set_tag(btag);
+      timings.begin("frames");
+      for (size_t f=0; f<angles.size(); ++f) {
+        TraceSpan span("frame", f);
+        cam.heading = angles[f];
+        {
+          TraceSpan rspan("rasterize", f);
+          render_perspective(view, cam, ox, oy, nthreads, img);
+        }
+        TraceSpan espan("encode", f);
+        (void) write_png_gray(frame_name(outfile, f, angles.size()).c_str(), (int)ox, (int)oy, TRUE,
+                              img, 0.0, 1.0, buf, 1);
+      }
+      timings.end((double)angles.size()*ox*oy, "pix");
+      free_2d_array_pb(buf);
+      std::cout << "Wrote frames " << frame_name(outfile, 0, angles.size()) << " to "
+                << frame_name(outfile, angles.size()-1, angles.size()) << std::endl;
+    }
+    free_2d_array_f(img);
+    if (dem) free_2d_array_f(dem);
+    report_timings();
+    return 0;
+  }
 
   //
   // generate the profile
   //
 
-  // find start and finish pixel positions
-
-  // default is straight across the image
-  float sx = 0.0;
-  float sy = ny/2.0f;
-  float fx = nx;
-  float fy = ny/2.0f;
-
-  // we go left-to-right, which means alpha+180 first
-  findIntersection(px*nx, py*ny, alpha+180.f, nx, ny, sx, sy);
-  findIntersection(px*nx, py*ny, alpha, nx, ny, fx, fy);
-  printf("  start and end points: %g %g %g %g\n", sx, sy, fx, fy);
-
-  // march along the line, setting elevation values
-  float* profile = allocate_1d_array_f((int)ox);
-  for (size_t i=0; i<ox; ++i) {
-    const float wgt = (i+0.5f)/ox;
-    const float tx = sx*(1.0f-wgt) + fx*wgt;
-    const float ty = sy*(1.0f-wgt) + fy*wgt;
-
-    // closest
-    //const size_t ix = std::max((size_t)0, std::min((size_t)(nx-1), (size_t)(tx+0.5f)));
-    //const size_t iy = std::max((size_t)0, std::min((size_t)(ny-1), (size_t)(ty+0.5f)));
-    //profile[i] = dem[ix][iy];
-
-    // Bilinear interpolation
-    const size_t x1 = std::max((size_t)0, std::min((size_t)(nx - 1), (size_t)tx));
-    const size_t y1 = std::max((size_t)0, std::min((size_t)(ny - 1), (size_t)ty));
-    const size_t x2 = std::min(nx - 1, x1 + 1);
-    const size_t y2 = std::min(ny - 1, y1 + 1);
-
-    const float x_diff = tx - x1;
-    const float y_diff = ty - y1;
-
-    profile[i] = dem[x1][y1] * (1 - x_diff) * (1 - y_diff) +
-                 dem[x2][y1] *      x_diff  * (1 - y_diff) +
-                 dem[x1][y2] * (1 - x_diff) *      y_diff +
-                 dem[x2][y2] *      x_diff  *      y_diff;
+  int tag = mem_set_tag(MEM_PROFILE);
+  float* profile = allocate_1d_array_f(ox);
+  mem_set_tag(tag);
+  SwathStats swath;
+  LineSet stack;
+  std::vector<float> density;
+  std::unique_ptr<DemPyramid> mip;
+
+  // draw whichever kind of profile was asked for
+  if (!losfile.empty()) los = true;
+  const float loseye = eyeheight / (zrange[1] - zrange[0]);
+  auto export_los = [&](const float len) {
+    if (losfile.empty()) return;
+    std::vector<unsigned char> vis(ox);
+    line_of_sight(profile, ox, loseye, vis.data());
+    write_los_intervals(losfile, vis.data(), ox, len);
+    std::cout << "  wrote line of sight to " << losfile << "\n";
+  };
+  auto render_frame = [&](const float* prof, const SwathStats& sw, const LineSet& st,
+                          float** img) {
+    if (!density.empty()) render_density(density, ox, oy, img);
+    else if (stackn > 0) render_stack(st, oy, stackheight, img);
+    else if (swathwidth > 0.f) render_swath(sw, ox, oy, img);
+    else render_profile(prof, ox, oy, img);
+    if (los && stackn == 0 && swathwidth <= 0.f && density.empty()) {
+      std::vector<unsigned char> vis(ox);
+      line_of_sight(prof, ox, loseye, vis.data());
+      shade_hidden(vis.data(), ox, oy, 0.6f, img);
+    }
+  };
+
+  // pyramids and their caches are keyed to the input
+  const std::string& source = !xyzdir.empty() ? xyzdir : (!mosaicfile.empty() ? mosaicfile : demfile);
+
+  // sweeps render and write their frames as they go; the sampling phase
+  // includes building any pyramid
+  const bool framesonly = !sweep.empty() && pathfile.empty() && !horizon && densityn == 0 && stripwidth <= 0.f;
+  double nsamples = ox;
+  timings.begin(framesonly ? "frames" : "sample");
+
+  if (horizon) {
+    // look all around from the datum
+    Observer obs;
+    obs.x = px*nx;
+    obs.y = py*ny;
+    obs.height = eyeheight;
+    obs.cellsize = cellsize;
+    obs.zlo = zrange[0];
+    obs.zhi = zrange[1];
+    obs.curvature = curvature;
+    std::cout << "  observer at " << obs.x << " " << obs.y << ", " << eyeheight << " m up\n";
+    swathwidth = 0.f;
+    stackn = 0;
+    stripwidth = 0.f;
+    los = false;
+
+    mip.reset(new DemPyramid(*grid, REDUCE_MAX, horizon_levels(*grid, ox), mipcache, source, enc, budget, nthreads));
+    std::vector<float> angles(ox);
+    horizon_angles(*mip, obs, alpha, ox, nthreads, angles.data());
+
+    // fit the skyline between a tenth of its range below and above
+    const float amin = *std::min_element(angles.begin(), angles.end());
+    const float amax = *std::max_element(angles.begin(), angles.end());
+    const float pad = std::max(0.1f, 0.1f*(amax-amin));
+    std::cout << "  horizon is " << amin << " to " << amax << " degrees, image shows "
+              << amin-pad << " to " << amax+pad << "\n";
+    for (size_t i=0; i<ox; ++i) profile[i] = (angles[i] - (amin-pad)) / (amax-amin + 2.f*pad);
+
+  } else if (!pathfile.empty()) {
+    // follow a polyline instead
+    const float scale = xyzgrid ? std::ldexp(1.f, xyzgrid->zoom_level() - pyramid->zmax) : 1.f;
+    const Polyline path = read_path(pathfile, ny, scale);
+    std::cout << "  path has " << path.x.size() << " vertices and is " << path.length() << " pixels long\n";
+    if (!sweep.empty()) std::cout << "  path profiles have no angle, ignoring --sweep\n";
+    if (usemip || exact || !reduce.empty() || swathwidth > 0.f || stackn > 0 || stripwidth > 0.f) {
+      std::cout << "  path profiles use bilinear samples, ignoring --mip, --exact, --reduce, --swath-width, --stack and --strip\n";
+      swathwidth = 0.f;
+      stackn = 0;
+      stripwidth = 0.f;
+    }
+    // stations along a bend are not on the sight line from the first one
+    if (los) {
+      std::cout << "  a path does not run straight from its start, ignoring --los and --los-out\n";
+      los = false;
+      losfile.clear();
+    }
+    if (xyzgrid) {
+      for (size_t k=0; k+1<path.x.size(); ++k) {
+        xyzgrid->prefetch_line(path.x[k], path.y[k], path.x[k+1], path.y[k+1], nthreads);
+      }
+    }
+    sample_path(*grid, path, ox, profile);
+
+  } else {
+    // or straight lines: find start and finish pixel positions
+    // the datum may be shifted sideways by offset dem pixels
+    auto line_ends = [&](const float angle, float& sx, float& sy, float& fx, float& fy,
+                         const float offset = 0.f) {
+      ::line_ends(nx, ny, px, py, angle, offset, sx, sy, fx, fy);
+    };
+
+    float sx, sy, fx, fy;
+    line_ends(alpha, sx, sy, fx, fy);
+    if (sweep.empty()) {
+      printf("  start and end points: %g %g %g %g\n", sx, sy, fx, fy);
+
+      // tile pyramids can load everything the line needs at once
+      if (xyzgrid) xyzgrid->prefetch_line(sx, sy, fx, fy, nthreads);
+    }
+
+    // spacing of samples along the line, in dem cells; a sweep plans
+    // for its longest possible line, the diagonal
+    const float linelen = sweep.empty() ? std::hypot(fx-sx, fy-sy) : std::hypot((float)nx, (float)ny);
+    const float spacing = linelen / ox;
+
+    // long lines with few samples need a filtered dem
+    if (usemip || !reduce.empty()) {
+      std::cout << "  samples are " << spacing << " cells apart\n";
+      const PyramidReduce op = reduce.empty() ? REDUCE_MEAN : parse_reduce(reduce);
+      mip.reset(new DemPyramid(*grid, op, DemPyramid::levels_for(spacing), mipcache, source, enc, budget, nthreads));
+    }
+
+    // march along the line, setting elevation values, and along
+    // parallel lines to either side
+    auto sample_line = [&](const float sx, const float sy, const float fx, const float fy,
+                           float* prof, SwathStats& sw, LineSet& st, const size_t nt) {
+      if (stackn > 0) {
+        // lines at the middles of stackn equal strips across the dem or width
+        float off0 = -0.5f*stackwidth;
+        float off1 = 0.5f*stackwidth;
+        if (stackwidth <= 0.f) normal_extent(*grid, sx, sy, fx, fy, off0, off1);
+        const float half = 0.5f * (off1-off0) / stackn;
+        sample_parallel_lines(*grid, sx, sy, fx, fy, ox, off0+half, off1-half, stackn, nt, st);
+        return;
+      }
+      if (exact) {
+        sample_exact(*grid, sx, sy, fx, fy, ox, prof);
+      } else if (!reduce.empty()) {
+        sample_footprint(*mip, sx, sy, fx, fy, ox, prof);
+      } else if (mip) {
+        sample_mip(*mip, sx, sy, fx, fy, ox, prof);
+      } else {
+        sample_bilinear(*grid, sx, sy, fx, fy, ox, prof);
+      }
+      if (swathwidth > 0.f) {
+        sample_swath(*grid, sx, sy, fx, fy, ox, swathwidth, swathlines,
+                     swathpct[0], swathpct[1], nt, sw);
+      }
+    };
+
+    if (densityn > 0 && stripwidth <= 0.f && (swathwidth > 0.f || stackn > 0)) {
+      std::cout << "  density plots sum one profile per line, ignoring --swath-width and --stack\n";
+      swathwidth = 0.f;
+      stackn = 0;
+    }
+    if (stackn > 0) {
+      std::cout << "  sampling stacks of " << stackn << " lines\n";
+    } else if (swathwidth > 0.f) {
+      std::cout << "  sampling swaths of " << swathlines << " lines " << swathwidth << " pixels wide\n";
+    }
+
+    if (stripwidth > 0.f) {
+      // rows as many cells apart as the columns are
+      const float len = std::hypot(fx-sx, fy-sy);
+      const size_t rows = std::max((size_t)1, (size_t)std::lround(stripwidth * ox / len));
+      const float half = 0.5f * stripwidth / rows;
+      std::cout << "  resampling a " << stripwidth << " pixel wide corridor to " << ox << " x " << rows << "\n";
+      sample_parallel_lines(*grid, sx, sy, fx, fy, ox, -0.5f*stripwidth+half, 0.5f*stripwidth-half,
+                            rows, nthreads, stack);
+      nsamples = (double)ox*rows;
+      write_strip(stack, outfile);
+      stack = LineSet();
+
+    } else if (densityn > 0) {
+      // each worker sums its own lines, then the sums are merged
+      const size_t nw = worker_count(densityn, nthreads);
+      std::cout << "  accumulating " << densityn << " lines on " << nw << " threads\n";
+      std::vector<std::vector<float>> accs(nw, std::vector<float>(ox*oy, 0.f));
+      std::vector<std::vector<float>> profs(nw, std::vector<float>(ox));
+      std::vector<SwathStats> swaths(nw);
+      std::vector<LineSet> stacks(nw);
+      std::atomic<size_t> left(densityn);
+      parallel_for_workers(densityn, nthreads, [&](const size_t w, const size_t k) {
+        TraceSpan span("line", k);
+        float u1, u2, lsx, lsy, lfx, lfy;
+        jitter(seed, k, u1, u2);
+        line_ends(alpha + u1*jitterangle, lsx, lsy, lfx, lfy, u2*jitteroffset);
+        sample_line(lsx, lsy, lfx, lfy, profs[w].data(), swaths[w], stacks[w], 1);
+        accumulate_profile(profs[w].data(), ox, oy, accs[w].data());
+        trace_counter("lines left", --left);
+      });
+      merge_tree(accs, nthreads);
+      density.swap(accs[0]);
+      nsamples = (double)ox*densityn;
+
+    } else if (sweep.empty()) {
+      sample_line(sx, sy, fx, fy, profile, swath, stack, nthreads);
+      export_los(std::hypot(fx-sx, fy-sy));
+      nsamples = (double)ox*(stackn > 0 ? stackn : 1 + (swathwidth > 0.f ? swathlines : 0));
+
+    } else {
+      // one frame per angle, each worker with its own buffers; frames
+      // are mostly flat black and white, so fast compression costs little
+      // in size
+      const std::vector<float> angles = parse_sweep(sweep);
+      const size_t nw = worker_count(angles.size(), nthreads);
+      std::cout << "  rendering " << angles.size() << " frames on " << nw << " threads\n";
+
+      std::vector<std::vector<float>> profs(nw, std::vector<float>(ox));
+      std::vector<SwathStats> swaths(nw);
+      std::vector<LineSet> stacks(nw);
+      std::vector<float**> imgs(nw);
+      std::vector<png_byte**> bufs(nw);
+      tag = mem_set_tag(MEM_PROFIMG);
+      for (size_t w=0; w<nw; ++w) imgs[w] = allocate_2d_array_f(ox, oy);
+      mem_set_tag(MEM_ENCODE_ROWS);
+      for (size_t w=0; w<nw; ++w) bufs[w] = allocate_2d_array_pb(ox, oy, 16);
+      mem_set_tag(tag);
+
+      std::atomic<size_t> left(angles.size());
+      parallel_for_workers(angles.size(), nthreads, [&](const size_t w, const size_t f) {
+        TraceSpan span("frame", f);
+        float fsx, fsy, ffx, ffy;
+        line_ends(angles[f], fsx, fsy, ffx, ffy);
+        {
+          TraceSpan sspan("sample", f);
+          sample_line(fsx, fsy, ffx, ffy, profs[w].data(), swaths[w], stacks[w], 1);
+        }
+        {
+          TraceSpan rspan("rasterize", f);
+          render_frame(profs[w].data(), swaths[w], stacks[w], imgs[w]);
+        }
+        {
+          TraceSpan espan("encode", f);
+          (void) write_png_gray(frame_name(outfile, f, angles.size()).c_str(), (int)ox, (int)oy, TRUE,
+                                imgs[w], 0.0, 1.0, bufs[w], 1);
+        }
+        trace_counter("frames left", --left);
+      });
+
+      for (size_t w=0; w<nw; ++w) {
+        free_2d_array_f(imgs[w]);
+        free_2d_array_pb(bufs[w]);
+      }
+      std::cout << "Wrote frames " << frame_name(outfile, 0, angles.size()) << " to "
+                << frame_name(outfile, angles.size()-1, angles.size()) << std::endl;
+    }
   }
+  if (framesonly) timings.end((double)parse_sweep(sweep).size()*ox*oy, "pix");
+  else timings.end(nsamples, "samples");
+
+  if (grid->tiles_loaded() > 0) std::cout << "  loaded " << grid->tiles_loaded() << " tiles\n";
 
   // free the dem
-  free_2d_array_f(dem);
+  mip.reset();
+  grid.reset();
+  if (dem) free_2d_array_f(dem);
+
+  // sweeps and strips already wrote their output
+  if (framesonly || stripwidth > 0.f) {
+    free_1d_array_f(profile);
+    report_timings();
+    return 0;
+  }
 
   //
   // generate the profile image
   //
-  float** profimg = allocate_2d_array_f((int)ox, (int)oy);
-
-  for (size_t i=0; i<ox; ++i) {
-    const float yval = profile[i] * oy;
-
-    // nearest
-    //const size_t yidx = yval+0.5;
-    //for (size_t j=0; j<yidx; ++j) profimg[i][j] = 0.0;
-    //for (size_t j=yidx; j<oy; ++j) profimg[i][j] = 1.0;
-
-    // linear interpolation
-    const float lefty = oy * ((i==0) ? (2.f*profile[0]-profile[1]) : profile[i-1]);
-    const float righty = oy * ((i==ox-1) ? (2.f*profile[ox-1]-profile[ox-2]) : profile[i+1]);
-    for (size_t j=0; j<oy; ++j) {
-      // half of the value comes from where we are between left and middle y values
-      const float ldist = ((j+0.5f)-(0.5f*(yval+lefty))) / (std::abs(yval-lefty) + 1.f);
-      profimg[i][j] = (ldist > 0.5f) ? 1.f : ((ldist < -0.5f) ? 0.f : (0.5f+ldist));
-      // other half the value comes from where we are between right and middle y values
-      const float rdist = ((j+0.5f)-(0.5f*(yval+righty))) / (std::abs(yval-righty) + 1.f);
-      profimg[i][j] += (rdist > 0.5f) ? 1.f : ((rdist < -0.5f) ? 0.f : (0.5f+rdist));
-      profimg[i][j] *= 0.5f;
-    }
-  }
+  tag = mem_set_tag(MEM_PROFIMG);
+  float** profimg = allocate_2d_array_f(ox, oy);
+  mem_set_tag(tag);
+  timings.begin("rasterize");
+  render_frame(profile, swath, stack, profimg);
+  timings.end((double)ox*oy, "pix");
 
   // free the profile
   free_1d_array_f(profile);
@@ -213,9 +708,12 @@ int main(int argc, char const *argv[]) {
 
   std::cout << "Writing dem to " << outfile << std::endl;
 
+  timings.begin("write");
   (void) write_png (outfile.c_str(), (int)ox, (int)oy, FALSE, TRUE,
                     profimg, 0.0, 1.0, nullptr, 0.0, 1.0, nullptr, 0.0, 1.0);
+  timings.end((double)ox*oy, "pix", Timings::file_bytes(outfile));
 
   free_2d_array_f(profimg);
+  report_timings();
 
 }
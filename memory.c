@@ -4,35 +4,138 @@
  * Copyright 2004-10 Mark J. Stock mstock@umich.edu
  */
 
+#include "memory.h"
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <malloc.h>
 #include <math.h>
+#include <pthread.h>
+
+/*
+ * allocation accounting: every block carries a small header with its
+ * size and tag, so frees need no lookup; the counters are only touched
+ * when tracking is on, and only big buffers come through here
+ */
+#define MEM_HEADER 16
+
+static int mem_tracking = 0;
+static __thread int mem_tag = MEM_OTHER;
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t mem_cur[MEM_NTAGS], mem_peak[MEM_NTAGS], mem_atpeak[MEM_NTAGS];
+static size_t mem_total = 0, mem_total_peak = 0;
+
+static void mem_count(const int tag, const size_t bytes, const int add) {
+   int t;
+   pthread_mutex_lock(&mem_lock);
+   if (add) {
+      mem_cur[tag] += bytes;
+      mem_total += bytes;
+   } else {
+      mem_cur[tag] -= bytes;
+      mem_total -= bytes;
+   }
+   if (mem_cur[tag] > mem_peak[tag]) mem_peak[tag] = mem_cur[tag];
+   // remember the mix at the overall high-water mark
+   if (mem_total > mem_total_peak) {
+      mem_total_peak = mem_total;
+      for (t=0; t<MEM_NTAGS; t++) mem_atpeak[t] = mem_cur[t];
+   }
+   pthread_mutex_unlock(&mem_lock);
+}
+
+void* mem_alloc(size_t bytes) {
+   char *block = (char *)malloc(bytes + MEM_HEADER);
+   if (block == NULL) return(NULL);
+   *(size_t *)block = bytes;
+   *(int *)(block + sizeof(size_t)) = mem_tag;
+   // blocks allocated before tracking started are never counted
+   *(int *)(block + sizeof(size_t) + sizeof(int)) = mem_tracking;
+   if (mem_tracking) mem_count(mem_tag, bytes, 1);
+   return(block + MEM_HEADER);
+}
+
+void mem_free(void* ptr) {
+   char *block;
+   if (ptr == NULL) return;
+   block = (char *)ptr - MEM_HEADER;
+   if (*(int *)(block + sizeof(size_t) + sizeof(int))) {
+      mem_count(*(int *)(block + sizeof(size_t)), *(size_t *)block, 0);
+   }
+   free(block);
+}
+
+int mem_set_tag(int tag) {
+   const int prev = mem_tag;
+   mem_tag = tag;
+   return(prev);
+}
+
+const char* mem_tag_name(int tag) {
+   static const char* names[MEM_NTAGS] = { "other", "dem", "png rows", "profile", "profimg",
+                                           "encode rows", "pyramid" };
+   return(names[tag]);
+}
+
+static void mem_report_stdout(void) {
+   mem_report(stdout);
+}
+
+void mem_track_enable(void) {
+   if (mem_tracking) return;
+   mem_tracking = 1;
+   atexit(mem_report_stdout);
+}
+
+void mem_report(FILE* fp) {
+   int t;
+   pthread_mutex_lock(&mem_lock);
+   fprintf(fp,"Memory by purpose, in MB:\n");
+   fprintf(fp,"  %-12s %10s %10s %10s\n","tag","current","peak","at peak");
+   for (t=0; t<MEM_NTAGS; t++) {
+      if (mem_peak[t] == 0) continue;
+      fprintf(fp,"  %-12s %10.2f %10.2f %10.2f\n",mem_tag_name(t),
+              mem_cur[t]/1048576.,mem_peak[t]/1048576.,mem_atpeak[t]/1048576.);
+   }
+   fprintf(fp,"  %-12s %10.2f %10.2f\n","total",mem_total/1048576.,mem_total_peak/1048576.);
+   pthread_mutex_unlock(&mem_lock);
+}
 
 /*
  * allocate memory for a one-dimensional array of float
  */
-float* allocate_1d_array_f(long int nx) {
+float* allocate_1d_array_f(size_t nx) {
 
-   float *array = (float *)malloc(nx * sizeof(float));
+   float *array = (float *)mem_alloc(nx * sizeof(float));
+   if (array == NULL) {
+      fprintf(stderr,"Could not allocate %zu floats\n",nx);
+      fflush(stderr);
+      exit(1);
+   }
 
    return(array);
 }
 
 int free_1d_array_f(float* array){
-   free(array);
+   mem_free(array);
    return(0);
 }
 
 /*
  * allocate memory for a two-dimensional array of float
  */
-float** allocate_2d_array_f(int nx,int ny) {
-
-   int i;
-   float **array = (float **)malloc(nx * sizeof(float *));
+float** allocate_2d_array_f(size_t nx,size_t ny) {
+
+   size_t i;
+   float **array = (float **)mem_alloc(nx * sizeof(float *));
+   float *data = (float *)mem_alloc(nx * ny * sizeof(float));
+   if (array == NULL || data == NULL) {
+      fprintf(stderr,"Could not allocate %zu x %zu floats\n",nx,ny);
+      fflush(stderr);
+      exit(1);
+   }
 
-   array[0] = (float *)malloc(nx * ny * sizeof(float));
+   array[0] = data;
    for (i=1; i<nx; i++)
       array[i] = array[0] + i * ny;
 
@@ -40,21 +143,21 @@ float** allocate_2d_array_f(int nx,int ny) {
 }
 
 int free_2d_array_f(float** array){
-   free(array[0]);
-   free(array);
+   mem_free(array[0]);
+   mem_free(array);
    return(0);
 }
 
 /*
  * allocate memory for a three-dimensional array of floats
  */
-float*** allocate_3d_array_f(int nx, int ny, int nz) {
+float*** allocate_3d_array_f(size_t nx, size_t ny, size_t nz) {
 
-   int i,j;
-   float ***array = (float ***)malloc(nx * sizeof(float **));
+   size_t i,j;
+   float ***array = (float ***)mem_alloc(nx * sizeof(float **));
 
-   array[0] = (float **)malloc(nx * ny * sizeof(float *));
-   array[0][0] = (float *)malloc(nx * ny * nz * sizeof(float));
+   array[0] = (float **)mem_alloc(nx * ny * sizeof(float *));
+   array[0][0] = (float *)mem_alloc(nx * ny * nz * sizeof(float));
 
    for (i=1; i<nx; i++)
       array[i] = array[0] + i * ny;
@@ -70,21 +173,21 @@ float*** allocate_3d_array_f(int nx, int ny, int nz) {
 }
 
 int free_3d_array_f(float*** array){
-   free(array[0][0]);
-   free(array[0]);
-   free(array);
+   mem_free(array[0][0]);
+   mem_free(array[0]);
+   mem_free(array);
    return(0);
 }
 
 /*
  * allocate memory for a two-dimensional array of ints
  */
-int** allocate_2d_array_i(int nx,int ny) {
+int** allocate_2d_array_i(size_t nx,size_t ny) {
 
-   int i;
-   int **array = (int **)malloc(nx * sizeof(int *));
+   size_t i;
+   int **array = (int **)mem_alloc(nx * sizeof(int *));
 
-   array[0] = (int *)malloc(nx * ny * sizeof(int));
+   array[0] = (int *)mem_alloc(nx * ny * sizeof(int));
    for (i=1; i<nx; i++)
       array[i] = array[0] + i * ny;
 
@@ -92,8 +195,8 @@ int** allocate_2d_array_i(int nx,int ny) {
 }
 
 int free_2d_array_i(int** array){
-   free(array[0]);
-   free(array);
+   mem_free(array[0]);
+   mem_free(array);
    return(0);
 }
 
@@ -6,20 +6,40 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 // allocation and utility routines
-float* allocate_1d_array_f (long int);
+// all sizes are size_t so that grids beyond 2^31 cells do not overflow
+float* allocate_1d_array_f (size_t);
 int free_1d_array_f (float*);
-float** allocate_2d_array_f (int,int);
+float** allocate_2d_array_f (size_t,size_t);
 int free_2d_array_f (float**);
-float*** allocate_3d_array_f(int,int,int);
+float*** allocate_3d_array_f(size_t,size_t,size_t);
 int free_3d_array_f(float***);
-int** allocate_2d_array_i (int,int);
+int** allocate_2d_array_i (size_t,size_t);
 int free_2d_array_i (int**);
 
+// raw buffers with the same accounting as the arrays above
+void* mem_alloc (size_t);
+void mem_free (void*);
+
+// what each allocation is for; the current tag is per thread, and
+// allocations remember theirs so frees are charged to the same one
+enum { MEM_OTHER, MEM_DEM, MEM_PNG_ROWS, MEM_PROFILE, MEM_PROFIMG, MEM_ENCODE_ROWS,
+       MEM_PYRAMID, MEM_NTAGS };
+int mem_set_tag (int);
+const char* mem_tag_name (int);
+
+// count current and peak bytes per tag from now on, and print the
+// summary at exit
+void mem_track_enable (void);
+void mem_report (FILE*);
+
 #ifdef __cplusplus
 }
 #endif
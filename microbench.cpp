@@ -0,0 +1,307 @@
+//
+// microbench.cpp - time the innermost kernels on cache-resident and cache-cold data
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "memory.h"
+#include "dem.h"
+#include "profile.h"
+#include "render.h"
+#include "timer.h"
+#include "CLI11.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <map>
+
+// keeps results alive so the compiler can not drop the work
+static volatile float sink;
+
+// repeatable uniform floats in [0,1)
+static float uniform(uint64_t& state) {
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (float)(state >> 40) / (float)(1ULL << 24);
+}
+
+struct Result {
+  std::string name;
+  double median, spread;
+  size_t rounds;
+  std::string unit;
+};
+
+//
+// warm up, then time rounds of at least mintime each until the last few
+// agree within tol, or maxtime runs out, and take the median round; fn
+// does work items per call
+//
+static Result measure_once(const std::string& name, const std::string& unit, const double work,
+                           const double mintime, const double maxtime, const double tol,
+                           const std::function<void()>& fn) {
+  const size_t window = 5;
+
+  // warm up caches, page tables and the clock governor, and size a round
+  size_t reps = 0;
+  double t0 = wall_seconds();
+  do { fn(); ++reps; } while (wall_seconds()-t0 < mintime);
+
+  std::vector<double> per;
+  double spread = 0.0;
+  const double tstart = wall_seconds();
+  while (true) {
+    t0 = wall_seconds();
+    for (size_t r=0; r<reps; ++r) fn();
+    per.push_back(1.e+9 * (wall_seconds()-t0) / (reps*work));
+    if (per.size() >= window) {
+      std::vector<double> last(per.end()-window, per.end());
+      std::sort(last.begin(), last.end());
+      spread = (last.back()-last.front()) / last.front();
+      if (spread < tol || wall_seconds()-tstart > maxtime) {
+        // the median of every round resists the odd slow one on a busy machine
+        std::vector<double> all(per);
+        std::nth_element(all.begin(), all.begin()+all.size()/2, all.end());
+        Result res = {name, all[all.size()/2], spread, per.size(), unit};
+        return res;
+      }
+    }
+  }
+}
+
+//
+// the lowest median of repeats separate measurements, since noise from
+// the rest of the machine only ever makes a kernel slower; a settled
+// measurement beats any that did not settle
+//
+static Result measure(const std::string& name, const std::string& unit, const double work,
+                      const double mintime, const double maxtime, const double tol,
+                      const size_t repeats, const std::function<void()>& fn) {
+  Result best = measure_once(name, unit, work, mintime, maxtime, tol, fn);
+  for (size_t k=1; k<repeats; ++k) {
+    const Result r = measure_once(name, unit, work, mintime, maxtime, tol, fn);
+    const bool settled = r.spread < tol, bestsettled = best.spread < tol;
+    if (settled > bestsettled || (settled == bestsettled && r.median < best.median)) best = r;
+  }
+  printf("  %-24s %10.3f %-9s +-%5.1f%% over %zu rounds%s\n", name.c_str(), best.median,
+         unit.c_str(), 50.0*best.spread, best.rounds, best.spread < tol ? "" : ", not settled");
+  return best;
+}
+
+// medians and spreads by kernel name from a file written with --json
+static std::map<std::string, Result> read_medians(const std::string& path) {
+  std::map<std::string, Result> medians;
+  std::ifstream is(path);
+  if (!is.good()) {
+    std::cerr << "Could not read baseline " << path << "\n";
+    exit(1);
+  }
+  std::string line;
+  while (std::getline(is, line)) {
+    char name[128];
+    double median, spread = 0.0;
+    const int got = sscanf(line.c_str(), " \"%127[^\"]\": {\"median\": %lf, \"spread\": %lf", name, &median, &spread);
+    if (got >= 2) medians[name] = {name, median, spread, 0, ""};
+  }
+  return medians;
+}
+
+//
+// compare with a baseline, print every kernel's change and return how
+// many got slower by more than threshold, or by more than the spread
+// recorded with it if that is wider, or went missing
+//
+static int compare_baseline(const std::vector<Result>& results, const std::string& path,
+                            const double threshold) {
+  const std::map<std::string, Result> base = read_medians(path);
+  int bad = 0;
+  printf("Compared with %s, failing above +%.0f%% or a kernel's recorded spread:\n", path.c_str(), 100.0*threshold);
+  printf("  %-24s %10s %10s %9s %8s\n", "kernel", "baseline", "current", "change", "allowed");
+  for (const Result& r : results) {
+    const auto it = base.find(r.name);
+    if (it == base.end()) {
+      printf("  %-24s %10s %10.3f %9s  not in baseline\n", r.name.c_str(), "-", r.median, "-");
+      continue;
+    }
+    const double allowed = std::max(threshold, it->second.spread);
+    const double change = r.median / it->second.median - 1.0;
+    const bool slow = change > allowed;
+    printf("  %-24s %10.3f %10.3f %+8.1f%% %+7.0f%%%s\n", r.name.c_str(), it->second.median, r.median,
+           100.0*change, 100.0*allowed, slow ? "  REGRESSION" : "");
+    if (slow) ++bad;
+  }
+  for (const auto& b : base) {
+    bool found = false;
+    for (const Result& r : results) found = found || (r.name == b.first);
+    if (!found) {
+      printf("  %-24s %10.3f %10s %9s  MISSING\n", b.first.c_str(), b.second.median, "-", "-");
+      ++bad;
+    }
+  }
+  return bad;
+}
+
+int main(int argc, char const *argv[]) {
+
+  CLI::App app{"Time findIntersection, bilinear sampling and column coverage"};
+  double mintime = 0.05;
+  app.add_option("--min-time", mintime, "seconds per timed round, default 0.05");
+  double maxtime = 3.0;
+  app.add_option("--max-time", maxtime, "give up waiting for stable rounds after this many seconds, default 3");
+  double tol = 0.02;
+  app.add_option("--tolerance", tol, "stop when the last 5 rounds are within this fraction, default 0.02");
+  size_t coldmb = 64;
+  app.add_option("--cold-mb", coldmb, "size of the cache-cold inputs in MB, well past the last-level cache, default 64");
+  size_t repeats = 3;
+  app.add_option("--repeats", repeats, "measure each kernel this many times and keep the lowest median, default 3");
+  std::string jsonfile;
+  app.add_option("--json", jsonfile, "also write the medians to this json file, if every kernel settled");
+  std::string basefile;
+  app.add_option("--baseline", basefile, "compare the medians with this file from --json, and fail on regressions");
+  double threshold = 0.3;
+  app.add_option("--threshold", threshold, "fraction slower than the baseline that counts as a regression, default 0.3");
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError &e) {
+    return app.exit(e);
+  }
+
+  std::vector<Result> results;
+  uint64_t rng = 12345;
+
+  //
+  // line placement: a small table of datums and angles, and one too big
+  // for any cache
+  //
+  {
+    const size_t nwarm = 1024;
+    const size_t ncold = std::max(nwarm, (coldmb << 20) / (3*sizeof(float)));
+    std::vector<float> px(ncold), py(ncold), pa(ncold);
+    for (size_t k=0; k<ncold; ++k) {
+      px[k] = 1000.f * uniform(rng);
+      py[k] = 800.f * uniform(rng);
+      pa[k] = 360.f * uniform(rng);
+    }
+    auto run = [&](const size_t off, const size_t n) {
+      float acc = 0.f;
+      for (size_t k=off; k<off+n; ++k) {
+        float x, y;
+        findIntersection(px[k], py[k], pa[k], 1000.f, 800.f, x, y);
+        acc += x + y;
+      }
+      sink = acc;
+    };
+    results.push_back(measure("intersect warm", "ns/call", nwarm, mintime, maxtime, tol, repeats, [&]() { run(0, nwarm); }));
+    // slices in turn, so each call finds its inputs evicted yet stays
+    // short enough for many rounds
+    const size_t nslice = std::min((size_t)1 << 16, ncold);
+    size_t slice = 0;
+    results.push_back(measure("intersect cold", "ns/call", nslice, mintime, maxtime, tol, repeats, [&]() {
+      run((slice++ % (ncold/nslice)) * nslice, nslice);
+    }));
+  }
+
+  //
+  // bilinear sampling: a line across a dem that fits in L2, and scattered
+  // points over one that fits in no cache
+  //
+  {
+    const size_t nsamp = 4096;
+    std::vector<float> tx(nsamp), ty(nsamp), out(nsamp);
+
+    const int64_t nwarm = 256;
+    float** small = allocate_2d_array_f(nwarm, nwarm);
+    for (int64_t k=0; k<nwarm*nwarm; ++k) small[0][k] = uniform(rng);
+    InCoreDem swarm(small, nwarm, nwarm);
+    for (size_t k=0; k<nsamp; ++k) {
+      const float w = (k+0.5f) / nsamp;
+      tx[k] = w * (nwarm-1);
+      ty[k] = 0.3f * w * (nwarm-1);
+    }
+    results.push_back(measure("bilinear warm", "ns/sample", nsamp, mintime, maxtime, tol, repeats, [&]() {
+      sample_points(swarm, tx.data(), ty.data(), nsamp, out.data());
+      sink = out[nsamp/2];
+    }));
+    free_2d_array_f(small);
+
+    const int64_t ncold = std::max((int64_t)512, (int64_t)std::sqrt((double)(coldmb << 20) / sizeof(float)));
+    float** big = allocate_2d_array_f(ncold, ncold);
+    for (int64_t k=0; k<ncold*ncold; ++k) big[0][k] = uniform(rng);
+    InCoreDem scold(big, ncold, ncold);
+    const size_t nbatch = 256;
+    std::vector<float> cx(nsamp*nbatch), cy(nsamp*nbatch);
+    for (size_t k=0; k<nsamp*nbatch; ++k) {
+      cx[k] = uniform(rng) * (ncold-1);
+      cy[k] = uniform(rng) * (ncold-1);
+    }
+    size_t batch = 0;
+    results.push_back(measure("bilinear cold", "ns/sample", nsamp, mintime, maxtime, tol, repeats, [&]() {
+      const size_t off = (batch++ % nbatch) * nsamp;
+      sample_points(scold, cx.data()+off, cy.data()+off, nsamp, out.data());
+      sink = out[nsamp/2];
+    }));
+    free_2d_array_f(big);
+  }
+
+  //
+  // column coverage: an image that fits in L2, and one that fits in no cache
+  //
+  {
+    auto bench_fill = [&](const std::string& name, const size_t ox, const size_t oy) {
+      std::vector<float> profile(ox);
+      for (size_t i=0; i<ox; ++i) profile[i] = 0.5f + 0.4f*std::sin(0.01f*i) + 0.05f*uniform(rng);
+      float** img = allocate_2d_array_f(ox, oy);
+      results.push_back(measure(name, "ns/pixel", (double)ox*oy, mintime, maxtime, tol, repeats, [&]() {
+        render_profile(profile.data(), ox, oy, img);
+        sink = img[ox/2][oy/2];
+      }));
+      free_2d_array_f(img);
+    };
+    bench_fill("coverage warm", 256, 256);
+    const size_t side = std::max((size_t)512, (size_t)std::sqrt((double)(coldmb << 20) / sizeof(float)));
+    bench_fill("coverage cold", side, side);
+  }
+
+  // a baseline from rounds that never agreed would fail or pass at random
+  if (!jsonfile.empty()) {
+    std::string unsettled;
+    for (const Result& r : results) {
+      if (r.spread >= tol) unsettled += (unsettled.empty() ? "" : ", ") + r.name;
+    }
+    if (!unsettled.empty()) {
+      std::cerr << "Not writing " << jsonfile << ", these kernels did not settle within --tolerance: "
+                << unsettled << "; run on a quieter machine or with a longer --max-time\n";
+      return 1;
+    }
+  }
+
+  if (!jsonfile.empty()) {
+    std::ofstream os(jsonfile);
+    os << "{\n";
+    for (size_t k=0; k<results.size(); ++k) {
+      const Result& r = results[k];
+      char buf[256];
+      snprintf(buf, sizeof(buf), "  \"%s\": {\"median\": %.4f, \"spread\": %.4f, \"rounds\": %zu, \"unit\": \"%s\"}%s\n",
+               r.name.c_str(), r.median, r.spread, r.rounds, r.unit.c_str(), k+1 < results.size() ? "," : "");
+      os << buf;
+    }
+    os << "}\n";
+    std::cout << "Wrote " << jsonfile << std::endl;
+  }
+
+  if (!basefile.empty()) {
+    const int bad = compare_baseline(results, basefile, threshold);
+    if (bad > 0) {
+      printf("%d kernel%s regressed\n", bad, bad > 1 ? "s" : "");
+      return 1;
+    }
+    printf("No regressions\n");
+  }
+  return 0;
+}
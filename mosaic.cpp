@@ -0,0 +1,147 @@
+//
+// mosaic.cpp - many png dem tiles presented as one virtual grid
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "mosaic.h"
+#include "inout.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+//
+// read the manifest, filling in missing tile sizes from the png headers
+//
+std::vector<MosaicEntry> MosaicDem::read_manifest(const std::string& filename) {
+
+  std::ifstream in(filename);
+  if (!in) {
+    std::cerr << "Could not open mosaic manifest " << filename << "\n";
+    exit(0);
+  }
+
+  std::string dir;
+  const size_t slash = filename.find_last_of('/');
+  if (slash != std::string::npos) dir = filename.substr(0, slash+1);
+
+  std::vector<MosaicEntry> list;
+  std::string line;
+  size_t lineno = 0;
+  while (std::getline(in, line)) {
+    ++lineno;
+    const size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+
+    std::istringstream ss(line);
+    MosaicEntry e;
+    if (!(ss >> e.path)) continue;
+    if (!(ss >> e.xoff >> e.yoff)) {
+      std::cerr << "  " << filename << ":" << lineno << " needs: path xoffset yoffset [width height]\n";
+      exit(0);
+    }
+    if (!(ss >> e.wdt >> e.hgt)) {
+      e.wdt = e.hgt = 0;
+    }
+    if (e.path[0] != '/') e.path = dir + e.path;
+
+    // only the header is read here, the pixels wait until first touch
+    if (e.wdt <= 0 || e.hgt <= 0) {
+      int hgt, wdt;
+      (void) read_png_res (e.path.c_str(), &hgt, &wdt);
+      e.wdt = wdt;
+      e.hgt = hgt;
+    }
+    list.push_back(e);
+  }
+
+  if (list.empty()) {
+    std::cerr << "Mosaic manifest " << filename << " lists no tiles\n";
+    exit(0);
+  }
+  return list;
+}
+
+int64_t MosaicDem::extent(const std::vector<MosaicEntry>& _tiles, const bool isx) {
+  int64_t maxval = 0;
+  for (const auto& e : _tiles) {
+    maxval = std::max(maxval, isx ? e.xoff+e.wdt : e.yoff+e.hgt);
+  }
+  return maxval;
+}
+
+MosaicDem::MosaicDem(const std::vector<MosaicEntry>& _tiles, const DemEncoding& _enc,
+                     const size_t budget)
+  : DemGrid(extent(_tiles,true), extent(_tiles,false)),
+    tiles(_tiles),
+    enc(_enc),
+    cache(budget, [this](const int64_t key) { return decode(key); }) {
+
+  // bins the size of the largest tile keep each list short
+  int64_t maxdim = 1;
+  for (const auto& e : tiles) maxdim = std::max(maxdim, std::max(e.wdt, e.hgt));
+  binsize = maxdim;
+  nbx = (nx+binsize-1)/binsize;
+  nby = (ny+binsize-1)/binsize;
+  bins.resize(nbx*nby);
+  for (size_t t=0; t<tiles.size(); ++t) {
+    const MosaicEntry& e = tiles[t];
+    if (e.xoff < 0 || e.yoff < 0) {
+      std::cerr << "Mosaic tile " << e.path << " has a negative offset\n";
+      exit(0);
+    }
+    for (int64_t bj=e.yoff/binsize; bj<=(e.yoff+e.hgt-1)/binsize; ++bj) {
+      for (int64_t bi=e.xoff/binsize; bi<=(e.xoff+e.wdt-1)/binsize; ++bi) {
+        bins[bj*nbx + bi].push_back(t);
+      }
+    }
+  }
+  zeros.assign(1, 0.f);
+
+  std::cout << "  mosaic of " << tiles.size() << " tiles is " << nx << " x " << ny << "\n";
+}
+
+//
+// decode one tile straight into its cache entry
+//
+std::shared_ptr<DemTile> MosaicDem::decode(const int64_t key) {
+  const MosaicEntry& e = tiles[key];
+
+  std::shared_ptr<DemTile> t = std::make_shared<DemTile>();
+  t->x0 = e.xoff;
+  t->y0 = ny - e.yoff - e.hgt;
+  t->nx = e.wdt;
+  t->ny = e.hgt;
+  t->ystride = e.hgt;
+  t->store.resize(e.wdt * e.hgt);
+  t->data = t->store.data();
+
+  // read_png wants column pointers, so point them into the tile store
+  std::vector<float*> cols(e.wdt);
+  for (int64_t i=0; i<e.wdt; ++i) cols[i] = t->store.data() + i*e.hgt;
+  read_dem_png(e.path, e.wdt, e.hgt, enc, cols.data());
+  return t;
+}
+
+TilePtr MosaicDem::tile_at(const int64_t ix, const int64_t iy) {
+  // tiles are placed in image coordinates, y down
+  const int64_t row = ny - 1 - iy;
+  for (const int64_t t : bins[(row/binsize)*nbx + ix/binsize]) {
+    const MosaicEntry& e = tiles[t];
+    if (ix >= e.xoff && ix < e.xoff+e.wdt && row >= e.yoff && row < e.yoff+e.hgt) {
+      return cache.get(t);
+    }
+  }
+
+  // a hole in the mosaic: a single zero-valued cell sharing one buffer
+  std::shared_ptr<DemTile> hole = std::make_shared<DemTile>();
+  hole->x0 = ix;
+  hole->y0 = iy;
+  hole->nx = 1;
+  hole->ny = 1;
+  hole->ystride = 0;
+  hole->data = zeros.data();
+  return hole;
+}
@@ -0,0 +1,47 @@
+//
+// mosaic.h - many png dem tiles presented as one virtual grid
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "dem.h"
+
+#include <string>
+#include <vector>
+
+// one line of the manifest; offsets and sizes are in image pixels,
+// with x to the right and y down from the top-left corner
+struct MosaicEntry {
+  std::string path;
+  int64_t xoff, yoff;
+  int64_t wdt, hgt;
+};
+
+// a grid made of png tiles listed in a text manifest, one per line:
+//   path xoffset yoffset [width height]
+// tiles are decoded on first touch and kept in a byte-bounded LRU cache;
+// cells not covered by any tile read as zero
+class MosaicDem : public DemGrid {
+public:
+  MosaicDem(const std::vector<MosaicEntry>& _tiles, const DemEncoding& _enc,
+            const size_t budget);
+  TilePtr tile_at(const int64_t ix, const int64_t iy) override;
+  size_t tiles_loaded() const override { return cache.loads(); }
+
+  // parse a manifest; relative paths are taken from the manifest's directory
+  static std::vector<MosaicEntry> read_manifest(const std::string& filename);
+
+private:
+  std::shared_ptr<DemTile> decode(const int64_t key);
+  static int64_t extent(const std::vector<MosaicEntry>&, const bool);
+
+  std::vector<MosaicEntry> tiles;
+  const DemEncoding enc;
+  // coarse bins over the grid, each listing the tiles that overlap it
+  int64_t binsize, nbx, nby;
+  std::vector<std::vector<int64_t>> bins;
+  std::vector<float> zeros;
+  TileCache cache;
+};
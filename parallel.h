@@ -0,0 +1,65 @@
+//
+// parallel.h - minimal thread helpers
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+// number of worker threads to use when the user asks for 0 (automatic)
+inline size_t default_threads(const size_t requested) {
+  if (requested > 0) return requested;
+  const size_t hw = std::thread::hardware_concurrency();
+  return (hw > 0) ? hw : 1;
+}
+
+// run func(i) for i in [0,n) on up to nthreads threads; items are handed
+// out one at a time, so uneven work still balances
+template <class Func>
+void parallel_for(const size_t n, const size_t nthreads, Func func) {
+  const size_t nt = std::min(n, default_threads(nthreads));
+  if (nt <= 1) {
+    for (size_t i=0; i<n; ++i) func(i);
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (size_t t=0; t<nt; ++t) {
+    workers.emplace_back([&]() {
+      for (size_t i=next++; i<n; i=next++) func(i);
+    });
+  }
+  for (auto& w : workers) w.join();
+}
+
+// threads that parallel_for_workers will start for n items
+inline size_t worker_count(const size_t n, const size_t nthreads) {
+  return std::max((size_t)1, std::min(n, default_threads(nthreads)));
+}
+
+// like parallel_for, but calls func(w, i) where w in [0,worker_count)
+// names the calling thread, so each can keep its own scratch buffers
+template <class Func>
+void parallel_for_workers(const size_t n, const size_t nthreads, Func func) {
+  const size_t nt = worker_count(n, nthreads);
+  if (nt <= 1) {
+    for (size_t i=0; i<n; ++i) func(0, i);
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (size_t t=0; t<nt; ++t) {
+    workers.emplace_back([&, t]() {
+      for (size_t i=next++; i<n; i=next++) func(t, i);
+    });
+  }
+  for (auto& w : workers) w.join();
+}
@@ -0,0 +1,68 @@
+//
+// path.cpp - profiles along polylines
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "path.h"
+#include "profile.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+Polyline read_path(const std::string& filename, const int64_t ny, const float scale) {
+
+  std::ifstream in(filename);
+  if (!in) {
+    std::cerr << "Could not open path file " << filename << "\n";
+    exit(0);
+  }
+
+  Polyline path;
+  std::string line;
+  while (std::getline(in, line)) {
+    const size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream ss(line);
+    float px, py;
+    if (!(ss >> px >> py)) continue;
+
+    // image row py is dem row ny-1-py
+    const float x = px * scale;
+    const float y = (float)(ny-1) - py * scale;
+    if (!path.x.empty() && x == path.x.back() && y == path.y.back()) continue;
+    path.dist.push_back(path.x.empty() ? 0.0 :
+                        path.dist.back() + std::hypot(x-path.x.back(), y-path.y.back()));
+    path.x.push_back(x);
+    path.y.push_back(y);
+  }
+
+  if (path.x.size() < 2) {
+    std::cerr << "Path file " << filename << " needs at least two distinct vertices\n";
+    exit(0);
+  }
+  return path;
+}
+
+void sample_path(DemGrid& grid, const Polyline& path, const size_t ox, float* profile) {
+
+  // place all the samples first, walking the segments once
+  std::vector<float> tx(ox), ty(ox);
+  const double total = path.length();
+  size_t seg = 0;
+  for (size_t i=0; i<ox; ++i) {
+    const double s = total * (i+0.5) / ox;
+    while (seg+2 < path.x.size() && path.dist[seg+1] < s) ++seg;
+    const double w = (s - path.dist[seg]) / (path.dist[seg+1] - path.dist[seg]);
+    tx[i] = path.x[seg] + (float)w * (path.x[seg+1] - path.x[seg]);
+    ty[i] = path.y[seg] + (float)w * (path.y[seg+1] - path.y[seg]);
+  }
+
+  // then look them all up in one batch
+  sample_points(grid, tx.data(), ty.data(), ox, profile);
+}
@@ -0,0 +1,30 @@
+//
+// path.h - profiles along polylines
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "dem.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// vertices of a path in dem cell coordinates
+struct Polyline {
+  std::vector<float> x, y;
+  std::vector<double> dist;     // cumulative arc length at each vertex
+
+  double length() const { return dist.empty() ? 0.0 : dist.back(); }
+};
+
+// read "x y" vertex pairs, one per line, in image pixels (y down from the
+// top row of an ny-row dem) and multiplied by scale; blank lines and
+// # comments are skipped
+Polyline read_path(const std::string& filename, const int64_t ny, const float scale = 1.f);
+
+// ox samples evenly spaced by arc length, at the centers of ox equal
+// stretches of the path, so the profile's x axis is distance along it
+void sample_path(DemGrid& grid, const Polyline& path, const size_t ox, float* profile);
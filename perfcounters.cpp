@@ -0,0 +1,91 @@
+//
+// perfcounters.cpp - hardware event counts from perf_event_open
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "perfcounters.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+const char* perf_event_name(const int e) {
+  static const char* names[PERF_NEVENTS] = { "cycles", "instructions", "llc_misses", "dtlb_misses",
+                                             "branch_misses" };
+  return names[e];
+}
+
+bool PerfCounts::any() const {
+  for (int e=0; e<PERF_NEVENTS; ++e) if (count[e] >= 0) return true;
+  return false;
+}
+
+static long perf_event_open(struct perf_event_attr* attr, const pid_t pid, const int cpu,
+                            const int group, const unsigned long flags) {
+  return syscall(__NR_perf_event_open, attr, pid, cpu, group, flags);
+}
+
+//
+// open each event on its own so that one the cpu lacks does not take the
+// others with it; inherited counters can not be read as a group anyway
+//
+PerfCounters::PerfCounters() {
+  const uint64_t cache_miss = PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+  const uint64_t cache_read = PERF_COUNT_HW_CACHE_OP_READ << 8;
+  const struct { uint32_t type; uint64_t config; } events[PERF_NEVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_read | cache_miss },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | cache_read | cache_miss },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES } };
+
+  for (int e=0; e<PERF_NEVENTS; ++e) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[e].type;
+    attr.config = events[e].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fd[e] = (int)perf_event_open(&attr, 0, -1, -1, 0);
+    if (fd[e] < 0 && why.empty()) why = strerror(errno);
+  }
+  if (available()) why.clear();
+}
+
+PerfCounters::~PerfCounters() {
+  for (int e=0; e<PERF_NEVENTS; ++e) if (fd[e] >= 0) close(fd[e]);
+}
+
+bool PerfCounters::available() const {
+  for (int e=0; e<PERF_NEVENTS; ++e) if (fd[e] >= 0) return true;
+  return false;
+}
+
+PerfCounts PerfCounters::read() const {
+  PerfCounts c;
+  for (int e=0; e<PERF_NEVENTS; ++e) {
+    if (fd[e] < 0) continue;
+    uint64_t buf[3];
+    if (::read(fd[e], buf, sizeof(buf)) != (ssize_t)sizeof(buf)) continue;
+    // the counter only ran for buf[2] of the buf[1] ns it was enabled
+    if (buf[2] == 0) c.count[e] = 0;
+    else if (buf[2] < buf[1]) c.count[e] = (int64_t)((double)buf[0] * buf[1] / buf[2]);
+    else c.count[e] = (int64_t)buf[0];
+  }
+  return c;
+}
+
+PerfCounts PerfCounters::delta(const PerfCounts& a, const PerfCounts& b) {
+  PerfCounts d;
+  for (int e=0; e<PERF_NEVENTS; ++e) {
+    if (a.count[e] >= 0 && b.count[e] >= 0) d.count[e] = std::max((int64_t)0, b.count[e] - a.count[e]);
+  }
+  return d;
+}
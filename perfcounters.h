@@ -0,0 +1,47 @@
+//
+// perfcounters.h - hardware event counts from perf_event_open
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// the events we count, in report order
+enum PerfEvent { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_DTLB_MISSES,
+                 PERF_BRANCH_MISSES, PERF_NEVENTS };
+
+// short names of the events, for reports
+const char* perf_event_name(const int e);
+
+// running totals of each event, or -1 if it could not be counted
+struct PerfCounts {
+  int64_t count[PERF_NEVENTS];
+  PerfCounts() { for (int e=0; e<PERF_NEVENTS; ++e) count[e] = -1; }
+  bool any() const;
+};
+
+// user-space counters for this process, including the threads it starts
+// after they are opened; any event the kernel, the cpu or a container
+// refuses is left out and reads as -1
+class PerfCounters {
+public:
+  PerfCounters();
+  ~PerfCounters();
+
+  bool available() const;
+  // why nothing could be counted, if so
+  const std::string& reason() const { return why; }
+
+  // current totals, scaled up if the kernel had to multiplex
+  PerfCounts read() const;
+
+  // per-event differences of two reads
+  static PerfCounts delta(const PerfCounts& a, const PerfCounts& b);
+
+private:
+  int fd[PERF_NEVENTS];
+  std::string why;
+};
@@ -0,0 +1,93 @@
+//
+// perspective.cpp - perspective views of the dem as a heightfield
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "perspective.h"
+#include "profile.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// earth radius, stretched by the usual 0.13 refraction coefficient
+static const double earth_radius = 6371000.0 / (1.0 - 0.13);
+
+static float far_distance(const DemGrid& grid, const Camera& cam) {
+  return (cam.far > 0.f) ? cam.far : std::hypot((float)grid.nx, (float)grid.ny);
+}
+
+int perspective_levels(const DemGrid& grid, const Camera& cam, const size_t ox) {
+  const float pixangle = cam.fov * pi() / 180.0 / ox;
+  return DemPyramid::levels_for(far_distance(grid, cam) * pixangle);
+}
+
+void render_perspective(DemPyramid& pyr, const Camera& cam, const size_t ox,
+                        const size_t oy, const size_t nthreads, float** img) {
+
+  DemGrid& base = pyr.level(0);
+  const Observer& obs = cam.eye;
+  const float xmax = base.nx - 1;
+  const float ymax = base.ny - 1;
+  const float zscale = obs.zhi - obs.zlo;
+  const float far = far_distance(base, cam);
+  const float fog = (cam.fog > 0.f) ? cam.fog : far / 3.f;
+
+  // pixels per unit of height over depth, and the row of the horizon
+  const float halfwidth = std::tan(0.5f * cam.fov * pi() / 180.0);
+  const float focal = 0.5f * ox / halfwidth;
+  const float pixangle = cam.fov * pi() / 180.0 / ox;
+  const float yhorizon = 0.5f * oy;
+
+  DemSampler ground(base);
+  const float zeye = obs.zlo + zscale * ground.bilinear(obs.x, obs.y) + obs.height;
+  const float heading = cam.heading * pi() / 180.0;
+
+  const size_t block = 16;
+  parallel_for((ox+block-1)/block, nthreads, [&](const size_t b) {
+    PyramidSampler sampler(pyr);
+    std::vector<float> cover(oy);
+    for (size_t i=b*block; i<std::min(ox, (b+1)*block); ++i) {
+      // a flat image plane, so depth is distance along the heading
+      const float u = (2.f*(i+0.5f)/ox - 1.f) * halfwidth;
+      const float az = heading + std::atan(u);
+      const float dx = std::sin(az);
+      const float dy = std::cos(az);
+      const float depthscale = 1.f / std::sqrt(1.f + u*u);
+
+      // each pixel gathers shade*coverage from the disjoint row spans
+      // that terrain fills in front to back, and sky covers the rest
+      float* col = img[i];
+      for (size_t j=0; j<oy; ++j) { col[j] = 0.f; cover[j] = 0.f; }
+      float ybuf = 0.f;
+      float d = 1.f;
+      while (d < far && ybuf < oy) {
+        const float tx = obs.x + d*dx;
+        const float ty = obs.y + d*dy;
+        if (tx < 0.f || ty < 0.f || tx > xmax || ty > ymax) break;
+
+        // columns are this many cells apart here
+        const float width = d * pixangle;
+        float z = obs.zlo + zscale * sampler.sample(tx, ty, std::log2(std::max(1.f, width)));
+        const float dist = d * obs.cellsize;
+        if (obs.curvature) z -= (float)(0.5 * dist * dist / earth_radius);
+        const float depth = dist * depthscale;
+        const float y = std::min((float)oy, yhorizon + focal * (z - zeye) / depth);
+
+        if (y > ybuf) {
+          const float shade = 1.f - std::exp(-d / fog);
+          for (int j=(int)ybuf; j<(int)std::ceil(y); ++j) {
+            const float c = std::min(y, j+1.f) - std::max(ybuf, (float)j);
+            col[j] += c * shade;
+            cover[j] += c;
+          }
+          ybuf = y;
+        }
+        d += std::max(0.5f, width);
+      }
+      for (size_t j=0; j<oy; ++j) col[j] += 1.f - cover[j];
+    }
+  });
+}
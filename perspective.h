@@ -0,0 +1,31 @@
+//
+// perspective.h - perspective views of the dem as a heightfield
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "pyramid.h"
+#include "horizon.h"
+
+#include <cstddef>
+
+// an observer looking level along heading, degrees clockwise from +y
+struct Camera {
+  Observer eye;
+  float heading = 0.f;
+  float fov = 60.f;             // horizontal field of view, degrees
+  float far = 0.f;              // farthest terrain drawn, cells; 0 is the dem diagonal
+  float fog = 0.f;              // distance at which fog is 63% thick, cells; 0 is far/3
+};
+
+// pyramid levels that render_perspective needs for ox columns
+int perspective_levels(const DemGrid& grid, const Camera& cam, const size_t ox);
+
+// draw the view into img[ox][oy], indexed like a dem: terrain is black
+// fading to the white sky with distance; each column marches one ray
+// front to back, filling only above the highest row drawn so far, with
+// steps and pyramid level growing with distance; columns run on nthreads
+void render_perspective(DemPyramid& pyr, const Camera& cam, const size_t ox,
+                        const size_t oy, const size_t nthreads, float** img);
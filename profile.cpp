@@ -0,0 +1,301 @@
+//
+// profile.cpp - placing lines on a dem and sampling elevations along them
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "profile.h"
+#include "simd.h"
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+//
+// finding intersection points of a point-angle combination with the box boundaries
+//
+void findIntersection(const float px, const float py, const float alpha,
+                      const float nx, const float ny,
+                      float& x_intersect, float& y_intersect) {
+
+  const float alpharad = std::fmod(alpha, 360.f) * pi() / 180.0;
+
+  // Check intersection with the right boundary
+  if (alpharad < pi() / 2 || alpharad > 3 * pi() / 2) {
+    x_intersect = nx;
+    y_intersect = py + std::tan(alpharad) * (nx - px);
+    //printf("  right bdry, testing %g %g\n", x_intersect, y_intersect);
+    if (y_intersect >= 0 && y_intersect <= ny) {
+      return;
+    }
+  } 
+
+  // Check intersection with the left boundary
+  if (alpharad > pi() / 2 && alpharad < 3 * pi() / 2) {
+    x_intersect = 0;
+    y_intersect = py - std::tan(alpharad) * px;
+    //printf("  left bdry, testing %g %g\n", x_intersect, y_intersect);
+    if (y_intersect >= 0 && y_intersect <= ny) {
+      return;
+    }
+  }
+
+  // Check intersection with the top boundary
+  if (alpharad > 0 && alpharad < pi()) {
+    y_intersect = ny;
+    x_intersect = px + (ny - py) / std::tan(alpharad);
+    //printf("  top bdry, testing %g %g\n", x_intersect, y_intersect);
+    if (x_intersect >= 0 && x_intersect <= nx) {
+      return;
+    }
+  }
+
+  // Check intersection with the bottom boundary
+  if (alpharad > pi() && alpharad < 2 * pi()) {
+    y_intersect = 0;
+    x_intersect = px - py / std::tan(alpharad);
+    //printf("  bottom bdry, testing %g %g\n", x_intersect, y_intersect);
+    if (x_intersect >= 0 && x_intersect <= nx) {
+      return;
+    }
+  }
+
+  // If no intersection is found, return the original point (this should not happen with valid inputs)
+  x_intersect = px;
+  y_intersect = py;
+  return;
+}
+
+void line_ends(const float nx, const float ny, const float px, const float py,
+               const float angle, const float offset,
+               float& sx, float& sy, float& fx, float& fy) {
+  // default is straight across the image
+  sx = 0.0;
+  sy = ny/2.0f;
+  fx = nx;
+  fy = ny/2.0f;
+
+  const float arad = angle * pi() / 180.0;
+  const float dpx = std::max(0.f, std::min(nx, px*nx - offset*std::sin(arad)));
+  const float dpy = std::max(0.f, std::min(ny, py*ny + offset*std::cos(arad)));
+
+  // we go left-to-right, which means alpha+180 first
+  findIntersection(dpx, dpy, angle+180.f, nx, ny, sx, sy);
+  findIntersection(dpx, dpy, angle, nx, ny, fx, fy);
+}
+
+
+//
+// batched bilinear sampling
+//
+
+// same weights and clamping as DemSampler::bilinear, over one array
+SIMD_CLONES
+static void bilinear_batch(const float* data, const int64_t ystride,
+                           const int64_t nx, const int64_t ny,
+                           const float* __restrict__ tx, const float* __restrict__ ty,
+                           const size_t n, float* __restrict__ out) {
+  const int xlast = (int)(nx-1);
+  const int ylast = (int)(ny-1);
+  for (size_t k=0; k<n; ++k) {
+    const int x1 = std::max(0, std::min(xlast, (int)tx[k]));
+    const int y1 = std::max(0, std::min(ylast, (int)ty[k]));
+    const int x2 = std::min(xlast, x1+1);
+    const int y2 = std::min(ylast, y1+1);
+    const float x_diff = tx[k] - x1;
+    const float y_diff = ty[k] - y1;
+    const float* c1 = data + (int64_t)x1*ystride;
+    const float* c2 = data + (int64_t)x2*ystride;
+    out[k] = c1[y1] * (1 - x_diff) * (1 - y_diff) +
+             c2[y1] *      x_diff  * (1 - y_diff) +
+             c1[y2] * (1 - x_diff) *      y_diff +
+             c2[y2] *      x_diff  *      y_diff;
+  }
+}
+
+void sample_points(DemGrid& grid, const float* tx, const float* ty, const size_t n,
+                   float* out) {
+  const TilePtr whole = grid.whole();
+  if (whole) {
+    bilinear_batch(whole->data, whole->ystride, grid.nx, grid.ny, tx, ty, n, out);
+  } else {
+    DemSampler sampler(grid);
+    for (size_t k=0; k<n; ++k) out[k] = sampler.bilinear(tx[k], ty[k]);
+  }
+}
+
+//
+// march along the line, setting elevation values
+//
+void sample_bilinear(DemGrid& grid, const float sx, const float sy,
+                     const float fx, const float fy, const size_t ox, float* profile) {
+  DemSampler sampler(grid);
+  for (size_t i=0; i<ox; ++i) {
+    const float wgt = (i+0.5f)/ox;
+    const float tx = sx*(1.0f-wgt) + fx*wgt;
+    const float ty = sy*(1.0f-wgt) + fy*wgt;
+
+    // closest
+    //profile[i] = sampler.at((int64_t)(tx+0.5f), (int64_t)(ty+0.5f));
+
+    // Bilinear interpolation
+    profile[i] = sampler.bilinear(tx, ty);
+  }
+}
+
+void sample_mip(DemPyramid& pyr, const float sx, const float sy,
+                const float fx, const float fy, const size_t ox, float* profile) {
+  PyramidSampler sampler(pyr);
+  const float spacing = std::hypot(fx-sx, fy-sy) / ox;
+  const float lod = std::log2(std::max(1.f, spacing));
+  for (size_t i=0; i<ox; ++i) {
+    const float wgt = (i+0.5f)/ox;
+    const float tx = sx*(1.0f-wgt) + fx*wgt;
+    const float ty = sy*(1.0f-wgt) + fy*wgt;
+    profile[i] = sampler.sample(tx, ty, lod);
+  }
+}
+
+void sample_footprint(DemPyramid& pyr, const float sx, const float sy,
+                      const float fx, const float fy, const size_t ox, float* profile) {
+  PyramidSampler sampler(pyr);
+  for (size_t i=0; i<ox; ++i) {
+    const float w0 = (float)i/ox;
+    const float w1 = (float)(i+1)/ox;
+    profile[i] = sampler.footprint(sx*(1.0f-w0) + fx*w0, sy*(1.0f-w0) + fy*w0,
+                                   sx*(1.0f-w1) + fx*w1, sy*(1.0f-w1) + fy*w1);
+  }
+}
+
+
+//
+// exact lattice traversal
+//
+// the bilinear surface is linear along every lattice line x=k and y=m, so
+// sampling where the line crosses them, in order, catches every cell the
+// line passes through; the crossings with each family of lines are evenly
+// spaced in t, which is what Amanatides-Woo steps through, so we generate
+// each family in a flat loop and merge them instead of branching per cell
+//
+
+// parameter t and elevation z where the line crosses n lattice lines
+// c = c0 + m*cstep, m=0..n-1; o is the other coordinate along the line,
+// and the dem cell (c,o) is at data[c*cstride + o*ostride]
+SIMD_CLONES
+static void lattice_crossings(const float* data, const int64_t cstride, const int64_t ostride,
+                              const int64_t omax, const int64_t c0, const int64_t cstep,
+                              const int64_t n, const float cstart, const float invdc,
+                              const float ostart, const float dodt,
+                              float* __restrict__ t, float* __restrict__ z) {
+
+  // first the crossing positions, which is pure arithmetic
+  const float first = ((float)c0 - cstart) * invdc;
+  const float dt = (float)cstep * invdc;
+  const float olast = (float)(omax-1);
+  // 32-bit counters: png dimensions are below 2^31, and int64-to-float
+  // converts do not vectorize before avx-512
+  const int nn = (int)n;
+  for (int m=0; m<nn; ++m) {
+    const float tt = first + (float)m*dt;
+    t[m] = tt;
+    z[m] = std::min(std::max(ostart + tt*dodt, 0.f), olast);
+  }
+
+  // then a gather and a lerp along the lattice line
+  const int jlast = (int)(omax-2);
+  for (int m=0; m<nn; ++m) {
+    const float o = z[m];
+    const int j = std::min((int)o, jlast);
+    const float f = o - (float)j;
+    const float* p = data + (c0 + m*cstep)*cstride + (int64_t)j*ostride;
+    z[m] = p[0] + f*(p[ostride] - p[0]);
+  }
+}
+
+// range of integer lattice lines strictly inside (a,b), clamped to [0,cmax-1]
+static void lattice_range(const float a, const float b, const int64_t cmax,
+                          int64_t& c0, int64_t& cstep, int64_t& n) {
+  if (b > a) {
+    c0 = std::max((int64_t)0, (int64_t)std::floor(a) + 1);
+    const int64_t c1 = std::min(cmax-1, (int64_t)std::ceil(b) - 1);
+    cstep = 1;
+    n = std::max((int64_t)0, c1 - c0 + 1);
+  } else if (b < a) {
+    c0 = std::min(cmax-1, (int64_t)std::ceil(a) - 1);
+    const int64_t c1 = std::max((int64_t)0, (int64_t)std::floor(b) + 1);
+    cstep = -1;
+    n = std::max((int64_t)0, c0 - c1 + 1);
+  } else {
+    c0 = 0; cstep = 1; n = 0;
+  }
+}
+
+void sample_exact(DemGrid& grid, const float sx, const float sy,
+                  const float fx, const float fy, const size_t ox, float* profile) {
+
+  DemSampler sampler(grid);
+  const float dx = fx - sx;
+  const float dy = fy - sy;
+
+  int64_t xc0, xstep, nxc, yc0, ystep, nyc;
+  lattice_range(sx, fx, grid.nx, xc0, xstep, nxc);
+  lattice_range(sy, fy, grid.ny, yc0, ystep, nyc);
+
+  // the two families of crossings, plus the end points
+  std::vector<float> tx(nxc), zx(nxc), ty(nyc), zy(nyc);
+  const TilePtr whole = grid.whole();
+  if (whole && grid.nx > 1 && grid.ny > 1) {
+    // the whole dem is one array: flat loops over it
+    if (nxc > 0) lattice_crossings(whole->data, whole->ystride, 1, grid.ny, xc0, xstep, nxc,
+                                   sx, 1.f/dx, sy, dy, tx.data(), zx.data());
+    if (nyc > 0) lattice_crossings(whole->data, 1, whole->ystride, grid.nx, yc0, ystep, nyc,
+                                   sy, 1.f/dy, sx, dx, ty.data(), zy.data());
+  } else {
+    // tiled dems go through the sampler
+    for (int64_t m=0; m<nxc; ++m) {
+      tx[m] = ((float)(xc0 + m*xstep) - sx) / dx;
+      zx[m] = sampler.bilinear(sx + tx[m]*dx, sy + tx[m]*dy);
+    }
+    for (int64_t m=0; m<nyc; ++m) {
+      ty[m] = ((float)(yc0 + m*ystep) - sy) / dy;
+      zy[m] = sampler.bilinear(sx + ty[m]*dx, sy + ty[m]*dy);
+    }
+  }
+
+  // merge into one increasing list of knots
+  std::vector<float> tk, zk;
+  tk.reserve(nxc + nyc + 2);
+  zk.reserve(nxc + nyc + 2);
+  tk.push_back(0.f);
+  zk.push_back(sampler.bilinear(sx, sy));
+  size_t a = 0, b = 0;
+  while (a < tx.size() || b < ty.size()) {
+    if (b >= ty.size() || (a < tx.size() && tx[a] < ty[b])) {
+      tk.push_back(tx[a]); zk.push_back(zx[a]); ++a;
+    } else {
+      tk.push_back(ty[b]); zk.push_back(zy[b]); ++b;
+    }
+  }
+  tk.push_back(1.f);
+  zk.push_back(sampler.bilinear(fx, fy));
+
+  // each output value is the mean of the piecewise-linear profile over its interval
+  size_t s = 0;
+  for (size_t i=0; i<ox; ++i) {
+    const float w0 = (float)i/ox;
+    const float w1 = (float)(i+1)/ox;
+    while (s+2 < tk.size() && tk[s+1] <= w0) ++s;
+    float area = 0.f;
+    for (size_t k=s; k+1<tk.size() && tk[k] < w1; ++k) {
+      const float ta = std::max(w0, tk[k]);
+      const float tb = std::min(w1, tk[k+1]);
+      if (tb <= ta) continue;
+      const float span = tk[k+1] - tk[k];
+      const float za = zk[k] + (zk[k+1]-zk[k]) * (ta-tk[k]) / span;
+      const float zb = zk[k] + (zk[k+1]-zk[k]) * (tb-tk[k]) / span;
+      area += 0.5f * (za + zb) * (tb - ta);
+    }
+    profile[i] = area / (w1 - w0);
+  }
+}
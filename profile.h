@@ -0,0 +1,50 @@
+//
+// profile.h - placing lines on a dem and sampling elevations along them
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "dem.h"
+#include "pyramid.h"
+
+#include <cstddef>
+
+constexpr double pi() { return 3.14159265358979323846; }
+
+// finding intersection points of a point-angle combination with the box boundaries
+void findIntersection(const float px, const float py, const float alpha,
+                      const float nx, const float ny,
+                      float& x_intersect, float& y_intersect);
+
+// ends of the line at angle degrees through the datum (px,py), given as
+// 0..1 fractions of an nx by ny dem and shifted sideways by offset dem
+// pixels, clipped to the dem and ordered left to right at angle 0
+void line_ends(const float nx, const float ny, const float px, const float py,
+               const float angle, const float offset,
+               float& sx, float& sy, float& fx, float& fy);
+
+// each of these fills profile[0..ox) with values from ox equal intervals
+// along the line from (sx,sy) to (fx,fy), in dem cell coordinates
+
+// bilinear samples at n arbitrary points, in one batched pass
+void sample_points(DemGrid& grid, const float* tx, const float* ty, const size_t n,
+                   float* out);
+
+// bilinear point sample at the center of each interval
+void sample_bilinear(DemGrid& grid, const float sx, const float sy,
+                     const float fx, const float fy, const size_t ox, float* profile);
+
+// trilinear sample from a mean pyramid, filtered to the interval length
+void sample_mip(DemPyramid& pyr, const float sx, const float sy,
+                const float fx, const float fy, const size_t ox, float* profile);
+
+// the pyramid's reduction (min, max or mean) over each interval's cells
+void sample_footprint(DemPyramid& pyr, const float sx, const float sy,
+                      const float fx, const float fy, const size_t ox, float* profile);
+
+// exact: every crossing of the line with the dem's cell lattice, where the
+// bilinear surface is linear, box-filtered down to ox intervals
+void sample_exact(DemGrid& grid, const float sx, const float sy,
+                  const float fx, const float fy, const size_t ox, float* profile);
@@ -0,0 +1,308 @@
+//
+// pyramid.cpp - mip pyramids of a dem for filtered sampling
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "pyramid.h"
+#include "memory.h"
+#include "parallel.h"
+#include "traverse.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <cstring>
+#include <sys/stat.h>
+
+// the cache file starts with these, all int64
+enum { MIP_MAGIC, MIP_NX, MIP_NY, MIP_LEVELS, MIP_REDUCE, MIP_SRCSIZE, MIP_SRCTIME,
+       MIP_ENCODING, MIP_LO, MIP_HI, MIP_HEADER };
+static const int64_t mip_magic = 0x3350494d4b50524dLL;   // "MRPKMIP3"
+
+// the exact bits of an encoding's range, so any change misses the cache
+static int64_t float_bits(const float f) {
+  int32_t b;
+  memcpy(&b, &f, sizeof(b));
+  return b;
+}
+
+// size and modification time identify the source file
+static void file_stamp(const std::string& path, int64_t& size, int64_t& mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    size = st.st_size;
+    mtime = st.st_mtime;
+  } else {
+    size = mtime = -1;
+  }
+}
+
+// reduce level cells [i0,i1) x [j0,j1) from the level below into out,
+// columns ystride apart; odd edges reuse the last cell
+static void reduce_cells(DemSampler& ds, const PyramidReduce op, const int64_t i0, const int64_t i1,
+                         const int64_t j0, const int64_t j1, float* out, const int64_t ystride) {
+  for (int64_t i=i0; i<i1; ++i) {
+    float* col = out + (i-i0)*ystride - j0;
+    for (int64_t j=j0; j<j1; ++j) {
+      const float a = ds.at(2*i, 2*j);
+      const float b = ds.at(2*i+1, 2*j);
+      const float c = ds.at(2*i, 2*j+1);
+      const float d = ds.at(2*i+1, 2*j+1);
+      if (op == REDUCE_MAX) col[j] = std::max(std::max(a,b), std::max(c,d));
+      else if (op == REDUCE_MIN) col[j] = std::min(std::min(a,b), std::min(c,d));
+      else col[j] = 0.25f * (a + b + c + d);
+    }
+  }
+}
+
+//
+// a level too big to keep whole: each tile is reduced from the level
+// below when first touched, which pulls in only the tiles under it
+//
+class ReducedDem : public DemGrid {
+public:
+  ReducedDem(DemGrid& _prev, const PyramidReduce _op, const int64_t _nx, const int64_t _ny,
+             const size_t budget)
+    : DemGrid(_nx, _ny), prev(_prev), op(_op), ntx((_nx+tsize-1)/tsize),
+      cache(budget, [this](const int64_t key) { return reduce_tile(key); }) {}
+  TilePtr tile_at(const int64_t ix, const int64_t iy) override {
+    return cache.get((iy/tsize)*ntx + ix/tsize);
+  }
+  size_t tiles_loaded() const override { return cache.loads(); }
+
+  static constexpr int64_t tsize = 256;
+
+private:
+  std::shared_ptr<DemTile> reduce_tile(const int64_t key) {
+    std::shared_ptr<DemTile> t = std::make_shared<DemTile>();
+    t->x0 = (key % ntx) * tsize;
+    t->y0 = (key / ntx) * tsize;
+    t->nx = std::min(tsize, nx - t->x0);
+    t->ny = std::min(tsize, ny - t->y0);
+    t->ystride = t->ny;
+    t->store.resize(t->nx * t->ny);
+    t->data = t->store.data();
+    DemSampler ds(prev);
+    reduce_cells(ds, op, t->x0, t->x0+t->nx, t->y0, t->y0+t->ny, t->store.data(), t->ystride);
+    return t;
+  }
+
+  DemGrid& prev;
+  const PyramidReduce op;
+  const int64_t ntx;
+  TileCache cache;
+};
+
+PyramidReduce parse_reduce(const std::string& name) {
+  if (name == "mean") return REDUCE_MEAN;
+  if (name == "min") return REDUCE_MIN;
+  if (name == "max") return REDUCE_MAX;
+  std::cerr << "Unknown reduction " << name << ", use mean, min or max\n";
+  exit(0);
+}
+
+DemPyramid::DemPyramid(DemGrid& _base, const PyramidReduce _op, const int nlevels,
+                       const std::string& cachefile, const std::string& sourcefile,
+                       const DemEncoding& _enc, const size_t budget, const size_t nthreads)
+  : base(_base), op(_op), enc(_enc) {
+
+  grids.push_back(&base);
+  arrays.push_back(nullptr);
+  lnx.push_back(base.nx);
+  lny.push_back(base.ny);
+
+  // never go below a single cell
+  int need = std::max(1, nlevels);
+  while (need > 1 && ((base.nx-1) >> (need-1)) == 0 && ((base.ny-1) >> (need-1)) == 0) --need;
+
+  if (need <= 1) return;
+
+  // the levels together are about a third of the base, which for a paged
+  // or tiled dem need not fit in memory at all
+  size_t levelbytes = 0;
+  for (int64_t k=1, cnx=base.nx, cny=base.ny; k<need; ++k) {
+    cnx = (cnx+1)/2;
+    cny = (cny+1)/2;
+    levelbytes += (size_t)(cnx*cny) * sizeof(float);
+  }
+  if (levelbytes > budget/4) {
+    std::cout << "  pyramid levels need " << (levelbytes>>20) << " MB, reducing tiles as they are read\n";
+    if (!cachefile.empty()) std::cout << "  levels are not kept whole, ignoring --mip-cache\n";
+    add_lazy_levels(need, budget/4);
+    return;
+  }
+
+  const int tag = mem_set_tag(MEM_PYRAMID);
+  const bool loaded = !cachefile.empty() && load(cachefile, sourcefile, need);
+  if (!loaded) build(need, nthreads);
+  mem_set_tag(tag);
+  if (loaded) {
+    std::cout << "  read " << levels()-1 << " pyramid levels from " << cachefile << "\n";
+    return;
+  }
+
+  std::cout << "  built " << levels()-1 << " pyramid levels\n";
+  if (!cachefile.empty()) save(cachefile, sourcefile);
+}
+
+DemPyramid::~DemPyramid() {
+  for (size_t k=1; k<grids.size(); ++k) {
+    delete grids[k];
+    if (arrays[k]) free_2d_array_f(arrays[k]);
+  }
+}
+
+void DemPyramid::add_level(float** arr, const int64_t _lnx, const int64_t _lny) {
+  grids.push_back(new InCoreDem(arr, _lnx, _lny));
+  arrays.push_back(arr);
+  lnx.push_back(_lnx);
+  lny.push_back(_lny);
+}
+
+// levels 1.. as tile caches sharing budget bytes, coarse levels reading
+// through the finer ones
+void DemPyramid::add_lazy_levels(const int need, const size_t budget) {
+  const size_t each = budget / (need-1);
+  for (int k=levels(); k<need; ++k) {
+    const int64_t cnx = (lnx[k-1]+1)/2;
+    const int64_t cny = (lny[k-1]+1)/2;
+    grids.push_back(new ReducedDem(*grids[k-1], op, cnx, cny, each));
+    arrays.push_back(nullptr);
+    lnx.push_back(cnx);
+    lny.push_back(cny);
+  }
+}
+
+//
+// each level is the 2x2 mean, min or max of the one below it
+//
+void DemPyramid::build(const int need, const size_t nthreads) {
+  for (int k=levels(); k<need; ++k) {
+    const int64_t pnx = lnx[k-1];
+    const int64_t pny = lny[k-1];
+    const int64_t cnx = (pnx+1)/2;
+    const int64_t cny = (pny+1)/2;
+    float** arr = allocate_2d_array_f(cnx, cny);
+    DemGrid& prev = *grids[k-1];
+
+    // hand out strips of columns so each thread keeps its tiles warm
+    const int64_t strip = 64;
+    parallel_for((cnx+strip-1)/strip, nthreads, [&](const size_t s) {
+      DemSampler ds(prev);
+      const int64_t i0 = s*strip;
+      reduce_cells(ds, op, i0, std::min(cnx, i0+strip), 0, cny, arr[i0], cny);
+    });
+    add_level(arr, cnx, cny);
+  }
+}
+
+bool DemPyramid::load(const std::string& cachefile, const std::string& sourcefile, const int need) {
+  FILE* fp = fopen(cachefile.c_str(), "rb");
+  if (!fp) return false;
+
+  int64_t hdr[MIP_HEADER];
+  int64_t srcsize, srctime;
+  file_stamp(sourcefile, srcsize, srctime);
+  if (fread(hdr, sizeof(int64_t), MIP_HEADER, fp) != MIP_HEADER ||
+      hdr[MIP_MAGIC] != mip_magic || hdr[MIP_NX] != base.nx || hdr[MIP_NY] != base.ny || hdr[MIP_REDUCE] != op ||
+      hdr[MIP_SRCSIZE] != srcsize || hdr[MIP_SRCTIME] != srctime || hdr[MIP_ENCODING] != enc.encoding ||
+      hdr[MIP_LO] != float_bits(enc.lo) || hdr[MIP_HI] != float_bits(enc.hi) || hdr[MIP_LEVELS] < need) {
+    fclose(fp);
+    return false;
+  }
+
+  for (int k=1; k<need; ++k) {
+    const int64_t cnx = (lnx[k-1]+1)/2;
+    const int64_t cny = (lny[k-1]+1)/2;
+    float** arr = allocate_2d_array_f(cnx, cny);
+    if (fread(arr[0], sizeof(float), cnx*cny, fp) != (size_t)(cnx*cny)) {
+      free_2d_array_f(arr);
+      fclose(fp);
+      // drop any levels we did read and start over
+      while (levels() > 1) {
+        delete grids.back();
+        free_2d_array_f(arrays.back());
+        grids.pop_back(); arrays.pop_back(); lnx.pop_back(); lny.pop_back();
+      }
+      return false;
+    }
+    add_level(arr, cnx, cny);
+  }
+  fclose(fp);
+  return true;
+}
+
+void DemPyramid::save(const std::string& cachefile, const std::string& sourcefile) const {
+  FILE* fp = fopen(cachefile.c_str(), "wb");
+  if (!fp) {
+    std::cerr << "  could not write pyramid cache " << cachefile << "\n";
+    return;
+  }
+  int64_t hdr[MIP_HEADER];
+  hdr[MIP_MAGIC] = mip_magic;
+  hdr[MIP_NX] = base.nx;
+  hdr[MIP_NY] = base.ny;
+  hdr[MIP_LEVELS] = levels();
+  hdr[MIP_REDUCE] = op;
+  file_stamp(sourcefile, hdr[MIP_SRCSIZE], hdr[MIP_SRCTIME]);
+  hdr[MIP_ENCODING] = enc.encoding;
+  hdr[MIP_LO] = float_bits(enc.lo);
+  hdr[MIP_HI] = float_bits(enc.hi);
+  fwrite(hdr, sizeof(int64_t), MIP_HEADER, fp);
+  for (int k=1; k<levels(); ++k) {
+    fwrite(arrays[k][0], sizeof(float), lnx[k]*lny[k], fp);
+  }
+  fclose(fp);
+  std::cout << "  wrote pyramid cache " << cachefile << "\n";
+}
+
+int DemPyramid::levels_for(const float spacing) {
+  if (spacing <= 1.f) return 1;
+  return 1 + (int)std::ceil(std::log2(spacing));
+}
+
+//
+// trilinear sampling
+//
+PyramidSampler::PyramidSampler(DemPyramid& _pyr) : pyr(_pyr) {
+  for (int k=0; k<pyr.levels(); ++k) samplers.emplace_back(pyr.level(k));
+}
+
+float PyramidSampler::at_level(const int k, const float tx, const float ty) {
+  if (k == 0) return samplers[0].bilinear(tx, ty);
+  // level-k cell i is centered on level-0 position (i+0.5)*2^k - 0.5
+  const float scale = std::ldexp(1.f, -k);
+  const float kx = std::max(0.f, (tx+0.5f)*scale - 0.5f);
+  const float ky = std::max(0.f, (ty+0.5f)*scale - 0.5f);
+  return samplers[k].bilinear(kx, ky);
+}
+
+float PyramidSampler::sample(const float tx, const float ty, const float lod) {
+  const float l = std::max(0.f, std::min((float)(pyr.levels()-1), lod));
+  const int k0 = (int)l;
+  const float frac = l - k0;
+  if (frac <= 0.f || k0+1 >= pyr.levels()) return at_level(k0, tx, ty);
+  return (1.f-frac) * at_level(k0, tx, ty) + frac * at_level(k0+1, tx, ty);
+}
+
+float PyramidSampler::footprint(const float x0, const float y0, const float x1, const float y1) {
+  const float len = std::hypot(x1-x0, y1-y0);
+  const int k = (len > 1.f) ? std::min(pyr.levels()-1, (int)std::log2(len)) : 0;
+  const double scale = std::ldexp(1.0, -k);
+  DemSampler& ds = samplers[k];
+
+  // level-k cell i covers level-0 positions [i*2^k-0.5, (i+1)*2^k-0.5)
+  const PyramidReduce op = pyr.reduction();
+  float val = (op == REDUCE_MAX) ? -std::numeric_limits<float>::max() :
+              (op == REDUCE_MIN) ?  std::numeric_limits<float>::max() : 0.f;
+  traverse_cells((x0+0.5)*scale, (y0+0.5)*scale, (x1+0.5)*scale, (y1+0.5)*scale,
+                 [&](const int64_t ix, const int64_t iy, const double ta, const double tb) {
+    const float z = ds.at(ix, iy);
+    if (op == REDUCE_MAX) val = std::max(val, z);
+    else if (op == REDUCE_MIN) val = std::min(val, z);
+    else val += (float)(tb-ta) * z;
+  });
+  return val;
+}
@@ -0,0 +1,76 @@
+//
+// pyramid.h - mip pyramids of a dem for filtered sampling
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "dem.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// how each pyramid level combines the 2x2 cells below it
+enum PyramidReduce { REDUCE_MEAN, REDUCE_MIN, REDUCE_MAX };
+
+// parse "mean", "min" or "max"
+PyramidReduce parse_reduce(const std::string& name);
+
+// successively 2x2-reduced copies of a dem; level 0 is the dem itself
+// and level k cell (i,j) covers level-0 cells [i*2^k,(i+1)*2^k)
+class DemPyramid {
+public:
+  // make at least nlevels levels: read them from cachefile if it was
+  // written for this sourcefile, encoding and reduction and has enough,
+  // otherwise build them from the base grid on nthreads threads and,
+  // given a cachefile, save them; levels that would not fit in a quarter
+  // of budget bytes are instead reduced a tile at a time as they are read
+  DemPyramid(DemGrid& _base, const PyramidReduce _op, const int nlevels,
+             const std::string& cachefile, const std::string& sourcefile,
+             const DemEncoding& _enc, const size_t budget, const size_t nthreads);
+  ~DemPyramid();
+
+  int levels() const { return (int)grids.size(); }
+  PyramidReduce reduction() const { return op; }
+  DemGrid& level(const int k) { return *grids[k]; }
+
+  // number of levels needed to filter samples spaced this many cells apart
+  static int levels_for(const float spacing);
+
+private:
+  bool load(const std::string& cachefile, const std::string& sourcefile, const int need);
+  void save(const std::string& cachefile, const std::string& sourcefile) const;
+  void build(const int need, const size_t nthreads);
+  void add_level(float** arr, const int64_t lnx, const int64_t lny);
+  void add_lazy_levels(const int need, const size_t budget);
+
+  DemGrid& base;
+  const PyramidReduce op;
+  const DemEncoding enc;            // how the source was decoded, for the cache
+  std::vector<DemGrid*> grids;      // grids[0] is &base
+  std::vector<float**> arrays;      // owned storage for levels 1.., null if lazy
+  std::vector<int64_t> lnx, lny;
+};
+
+// filtered sampling from a pyramid; keep one per thread
+class PyramidSampler {
+public:
+  explicit PyramidSampler(DemPyramid& _pyr);
+
+  // value at level-0 position (tx,ty), filtered over a footprint of
+  // about 2^lod cells, blending the two nearest levels
+  float sample(const float tx, const float ty, const float lod);
+
+  // the pyramid's reduction over the cells that the segment between two
+  // level-0 positions passes through, read from the level where the
+  // segment spans one or two cells, so the cost does not grow with length;
+  // the cells are those blocks, so up to the segment's length across
+  float footprint(const float x0, const float y0, const float x1, const float y1);
+
+private:
+  float at_level(const int k, const float tx, const float ty);
+  DemPyramid& pyr;
+  std::vector<DemSampler> samplers;
+};
@@ -0,0 +1,123 @@
+//
+// render.cpp - drawing profiles into images
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "render.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+void fill_column(const float* profile, const size_t ox, const size_t oy,
+                 const size_t i, float* col) {
+  const float yval = profile[i] * oy;
+
+  // nearest
+  //const size_t yidx = yval+0.5;
+  //for (size_t j=0; j<yidx; ++j) col[j] = 0.0;
+  //for (size_t j=yidx; j<oy; ++j) col[j] = 1.0;
+
+  // linear interpolation
+  const float lefty = oy * ((i==0) ? (2.f*profile[0]-profile[1]) : profile[i-1]);
+  const float righty = oy * ((i==ox-1) ? (2.f*profile[ox-1]-profile[ox-2]) : profile[i+1]);
+  // an int counter lets the loop vectorize
+  for (int j=0; j<(int)oy; ++j) {
+    // half of the value comes from where we are between left and middle y values
+    const float ldist = ((j+0.5f)-(0.5f*(yval+lefty))) / (std::abs(yval-lefty) + 1.f);
+    col[j] = (ldist > 0.5f) ? 1.f : ((ldist < -0.5f) ? 0.f : (0.5f+ldist));
+    // other half the value comes from where we are between right and middle y values
+    const float rdist = ((j+0.5f)-(0.5f*(yval+righty))) / (std::abs(yval-righty) + 1.f);
+    col[j] += (rdist > 0.5f) ? 1.f : ((rdist < -0.5f) ? 0.f : (0.5f+rdist));
+    col[j] *= 0.5f;
+  }
+}
+
+void render_profile(const float* profile, const size_t ox, const size_t oy,
+                    float** profimg) {
+  for (size_t i=0; i<ox; ++i) fill_column(profile, ox, oy, i, profimg[i]);
+}
+
+void shade_hidden(const unsigned char* visible, const size_t ox, const size_t oy,
+                  const float gray, float** profimg) {
+  for (size_t i=0; i<ox; ++i) {
+    if (visible[i]) continue;
+    float* col = profimg[i];
+    for (int j=0; j<(int)oy; ++j) col[j] += (1.f - col[j]) * gray;
+  }
+}
+
+void render_swath(const SwathStats& stats, const size_t ox, const size_t oy,
+                  float** profimg) {
+  const std::vector<float>* bands[4] = {&stats.max, &stats.hi, &stats.lo, &stats.min};
+  std::vector<float> col(oy);
+  for (size_t i=0; i<ox; ++i) {
+    // each band boundary takes away a quarter of the brightness below it
+    for (size_t j=0; j<oy; ++j) profimg[i][j] = 0.f;
+    for (int b=0; b<4; ++b) {
+      fill_column(bands[b]->data(), ox, oy, i, col.data());
+      for (size_t j=0; j<oy; ++j) profimg[i][j] += 0.25f * col[j];
+    }
+
+    // then the mean, one pixel wide
+    const float ymean = stats.mean[i] * oy;
+    for (size_t j=0; j<oy; ++j) {
+      const float cover = std::max(0.f, 1.f - std::abs(j+0.5f-ymean));
+      profimg[i][j] *= 1.f - cover;
+    }
+  }
+}
+
+void render_stack(const LineSet& lines, const size_t oy, const float height,
+                  float** profimg) {
+  const size_t ox = lines.ox;
+  const size_t n = lines.nlines;
+
+  // stretch the relief of everything on the dem to 0..1
+  float lo = std::numeric_limits<float>::max();
+  float hi = -lo;
+  for (size_t k=0; k<n*ox; ++k) {
+    if (!lines.ondem[k]) continue;
+    lo = std::min(lo, lines.vals[k]);
+    hi = std::max(hi, lines.vals[k]);
+  }
+  const float scale = (hi > lo) ? 1.f/(hi-lo) : 0.f;
+
+  // baselines one gap apart, with a gap of margin at the bottom and top
+  const float gap = oy / (n + height + 1.f);
+  auto ypos = [&](const size_t l, const size_t i) {
+    return gap * (1.f + l + height * (lines.vals[l*ox+i] - lo) * scale);
+  };
+
+  for (size_t i=0; i<ox; ++i) {
+    for (size_t j=0; j<oy; ++j) profimg[i][j] = 1.f;
+  }
+
+  // front to back, each line only shows above everything drawn before it
+  std::vector<float> horizon(ox, 0.f);
+  for (size_t l=0; l<n; ++l) {
+    const unsigned char* ok = lines.ondem.data() + l*ox;
+    for (size_t i=0; i<ox; ++i) {
+      if (!ok[i]) continue;
+
+      // one pixel thick, and reaching halfway to each neighbor
+      const float yc = ypos(l, i);
+      const float yl = (i > 0 && ok[i-1]) ? 0.5f*(yc + ypos(l, i-1)) : yc;
+      const float yr = (i+1 < ox && ok[i+1]) ? 0.5f*(yc + ypos(l, i+1)) : yc;
+      const float top = std::max(yc, std::max(yl, yr)) + 0.5f;
+      const float bot = std::max(horizon[i], std::min(yc, std::min(yl, yr)) - 0.5f);
+
+      // antialias by the covered part of each pixel
+      float* col = profimg[i];
+      const int j0 = std::max(0, (int)bot);
+      const int j1 = std::min((int)oy, (int)std::ceil(top));
+      for (int j=j0; j<j1; ++j) {
+        const float cover = std::min(top, j+1.f) - std::max(bot, (float)j);
+        if (cover > 0.f) col[j] *= 1.f - cover;
+      }
+      horizon[i] = std::max(horizon[i], yc);
+    }
+  }
+}
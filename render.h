@@ -0,0 +1,36 @@
+//
+// render.h - drawing profiles into images
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "swath.h"
+
+#include <cstddef>
+
+// antialiased fill of column i: col[j] is 1 for sky above the profile
+// and 0 for ground below it, with profile values in 0..1 of the height oy
+void fill_column(const float* profile, const size_t ox, const size_t oy,
+                 const size_t i, float* col);
+
+// the plain profile image, profimg[i][j] indexed like a dem
+void render_profile(const float* profile, const size_t ox, const size_t oy,
+                    float** profimg);
+
+// lighten the ground under stations that are not visible to gray
+void shade_hidden(const unsigned char* visible, const size_t ox, const size_t oy,
+                  const float gray, float** profimg);
+
+// a swath as shaded bands: white above the max, then lighter to darker
+// grays down through the high percentile, the low percentile and the min,
+// black below, and the mean as a thin black line
+void render_swath(const SwathStats& stats, const size_t ox, const size_t oy,
+                  float** profimg);
+
+// a ridgeline plot of parallel lines, the first at the bottom of the image
+// and in front; each line is raised by its relief times height row gaps and
+// hides what lies behind and below it, through a per-column horizon
+void render_stack(const LineSet& lines, const size_t oy, const float height,
+                  float** profimg);
@@ -0,0 +1,536 @@
+//
+// serve.cpp - answer profile requests over a unix socket, with dems kept resident
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "serve.h"
+#include "memory.h"
+#include "inout.h"
+#include "profile.h"
+#include "render.h"
+#include "parallel.h"
+#include "timer.h"
+
+#include <iostream>
+#include <map>
+#include <algorithm>
+#include <list>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+namespace {
+
+//
+// decoded dems, shared by all workers
+//
+
+struct ResidentDem {
+  float** dem = nullptr;
+  int64_t nx = 0, ny = 0;
+  std::unique_ptr<InCoreDem> grid;
+  std::string error;
+  ~ResidentDem() {
+    grid.reset();
+    if (dem) free_2d_array_f(dem);
+  }
+  size_t bytes() const { return (size_t)nx*ny*sizeof(float); }
+};
+typedef std::shared_ptr<ResidentDem> DemPtr;
+
+// bad or truncated pngs become an error for this request, not an exit
+DemPtr load_dem(const std::string& path, const DemEncoding& enc) {
+  DemPtr r = std::make_shared<ResidentDem>();
+  char err[512];
+  int hgt = 0, wdt = 0;
+  if (try_read_png_res(path.c_str(), &hgt, &wdt, err, sizeof(err)) != 0) {
+    r->error = err;
+    return r;
+  }
+  if (hgt < 1 || wdt < 1) {
+    r->error = path + " is empty";
+    return r;
+  }
+  r->nx = wdt;
+  r->ny = hgt;
+  const int tag = mem_set_tag(MEM_DEM);
+  r->dem = allocate_2d_array_f(r->nx, r->ny);
+  mem_set_tag(tag);
+  if (!try_read_dem_png(path, r->nx, r->ny, enc, r->dem, r->error)) return r;
+  r->grid.reset(new InCoreDem(r->dem, r->nx, r->ny));
+  return r;
+}
+
+// dems by path, reloaded when the file changes and dropped least recently
+// used first when over budget; a dem being decoded is waited on rather
+// than decoded twice, and one still in use lives until its last request ends
+class DemCache {
+public:
+  DemCache(const DemEncoding& _enc, const size_t _budget) : enc(_enc), budget(_budget) {}
+
+  DemPtr get(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      DemPtr r = std::make_shared<ResidentDem>();
+      r->error = "could not open " + path;
+      return r;
+    }
+
+    std::unique_lock<std::mutex> lock(mtx);
+    auto it = entries.find(path);
+    if (it != entries.end() && it->second.size == st.st_size && it->second.mtime == st.st_mtime) {
+      lru.splice(lru.begin(), lru, it->second.pos);
+      std::shared_future<DemPtr> pending = it->second.dem;
+      lock.unlock();
+      return pending.get();
+    }
+    if (it != entries.end()) drop(it);
+
+    // claim the slot, then decode outside of the lock
+    std::promise<DemPtr> promise;
+    lru.push_front(path);
+    Entry& e = entries[path];
+    e.dem = promise.get_future().share();
+    e.size = st.st_size;
+    e.mtime = st.st_mtime;
+    e.pos = lru.begin();
+    const uint64_t mine = e.gen = ++generation;
+    lock.unlock();
+
+    const double t0 = wall_seconds();
+    DemPtr r = load_dem(path, enc);
+    promise.set_value(r);
+
+    lock.lock();
+    it = entries.find(path);
+    // the file may have changed again while this decoded
+    const bool current = (it != entries.end() && it->second.gen == mine);
+    if (!r->error.empty()) {
+      // do not keep failures, so a fixed file is tried again
+      if (current) drop(it);
+      return r;
+    }
+    if (current) {
+      it->second.bytes = r->bytes();
+      curbytes += r->bytes();
+    }
+    printf("  decoded %s, %ld x %ld, in %.1f ms\n", path.c_str(), (long)r->nx, (long)r->ny,
+           1000.0*(wall_seconds()-t0));
+    while (curbytes > budget && lru.size() > 1) {
+      auto victim = entries.find(lru.back());
+      printf("  dropping %s\n", victim->first.c_str());
+      drop(victim);
+    }
+    fflush(stdout);
+    return r;
+  }
+
+private:
+  struct Entry {
+    std::shared_future<DemPtr> dem;
+    int64_t size = -1, mtime = -1;
+    size_t bytes = 0;
+    uint64_t gen = 0;
+    std::list<std::string>::iterator pos;
+  };
+
+  void drop(std::map<std::string, Entry>::iterator it) {
+    curbytes -= it->second.bytes;
+    lru.erase(it->second.pos);
+    entries.erase(it);
+  }
+
+  const DemEncoding enc;
+  const size_t budget;
+  std::mutex mtx;
+  std::map<std::string, Entry> entries;
+  std::list<std::string> lru;      // most recently used first
+  size_t curbytes = 0;
+  uint64_t generation = 0;
+};
+
+//
+// just enough json for flat objects of strings and numbers
+//
+
+bool parse_object(const std::string& s, std::map<std::string, std::string>& kv, std::string& err) {
+  size_t p = 0;
+  auto skip = [&]() { while (p < s.size() && isspace((unsigned char)s[p])) ++p; };
+  auto read_string = [&](std::string& out) {
+    if (p >= s.size() || s[p] != '"') return false;
+    for (++p; p < s.size() && s[p] != '"'; ++p) {
+      if (s[p] != '\\') {
+        out += s[p];
+        continue;
+      }
+      if (++p >= s.size()) return false;
+      switch (s[p]) {
+        case 'n': out += '\n'; break;
+        case 't': out += '\t'; break;
+        case 'r': out += '\r'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u': {
+          if (p+4 >= s.size()) return false;
+          const long c = strtol(s.substr(p+1, 4).c_str(), nullptr, 16);
+          out += (c < 128) ? (char)c : '?';
+          p += 4;
+          break;
+        }
+        default: out += s[p];
+      }
+    }
+    if (p >= s.size()) return false;
+    ++p;
+    return true;
+  };
+
+  skip();
+  if (p >= s.size() || s[p] != '{') { err = "request is not a json object"; return false; }
+  ++p;
+  skip();
+  if (p < s.size() && s[p] == '}') return true;
+  while (p < s.size()) {
+    std::string key, val;
+    skip();
+    if (!read_string(key)) { err = "bad key in request"; return false; }
+    skip();
+    if (p >= s.size() || s[p] != ':') { err = "missing : after " + key; return false; }
+    ++p;
+    skip();
+    if (p < s.size() && s[p] == '"') {
+      if (!read_string(val)) { err = "bad string for " + key; return false; }
+    } else {
+      while (p < s.size() && s[p] != ',' && s[p] != '}' && !isspace((unsigned char)s[p])) val += s[p++];
+    }
+    kv[key] = val;
+    skip();
+    if (p < s.size() && s[p] == ',') { ++p; continue; }
+    if (p < s.size() && s[p] == '}') return true;
+    err = "expected , or } after " + key;
+    return false;
+  }
+  err = "unterminated request";
+  return false;
+}
+
+std::string quote(const std::string& s) {
+  std::string out = "\"";
+  for (const char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    if (c == '\n') { out += "\\n"; continue; }
+    out += c;
+  }
+  return out + "\"";
+}
+
+bool send_all(const int fd, const void* data, size_t len) {
+  const char* p = (const char*)data;
+  while (len > 0) {
+    const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool send_error(const int fd, const std::string& msg) {
+  const std::string line = "{\"ok\":false,\"error\":" + quote(msg) + "}\n";
+  return send_all(fd, line.data(), line.size());
+}
+
+//
+// one request: the plain bilinear profile, as makeprofile draws it by default
+//
+bool handle_request(const int fd, const std::string& line, const std::string& servedir, DemCache& cache) {
+  const double t0 = wall_seconds();
+  std::map<std::string, std::string> kv;
+  std::string err;
+  if (!parse_object(line, kv, err)) return send_error(fd, err);
+
+  auto number = [&](const char* key, const double dflt, double& val) {
+    val = dflt;
+    auto it = kv.find(key);
+    if (it == kv.end()) return true;
+    char* end;
+    val = strtod(it->second.c_str(), &end);
+    if (end == it->second.c_str() || *end != '\0') {
+      err = std::string(key) + " is not a number";
+      return false;
+    }
+    return true;
+  };
+  double px, py, angle, dox, doy;
+  if (!number("px", 0.5, px) || !number("py", 0.5, py) || !number("angle", 0.0, angle) ||
+      !number("ox", 1000, dox) || !number("oy", 1000, doy)) return send_error(fd, err);
+  if (dox < 2 || doy < 1 || dox*doy > 1.e+8) return send_error(fd, "ox must be at least 2, oy at least 1, and ox*oy at most 1e8");
+  const size_t ox = (size_t)dox;
+  const size_t oy = (size_t)doy;
+  const std::string format = kv.count("format") ? kv["format"] : "png";
+  if (format != "png" && format != "path") return send_error(fd, "format must be png or path");
+  // the server, not any client on the socket, decides which files it writes
+  if (kv.count("out")) return send_error(fd, "out is not accepted, path images go to the --serve-dir");
+  if (!kv.count("dem")) return send_error(fd, "request needs a dem");
+
+  DemPtr dem = cache.get(kv["dem"]);
+  if (!dem->error.empty()) return send_error(fd, dem->error);
+
+  // sample, draw and encode, all on this thread
+  float sx, sy, fx, fy;
+  line_ends(dem->nx, dem->ny, px, py, angle, 0.f, sx, sy, fx, fy);
+  const int tag = mem_set_tag(MEM_PROFILE);
+  float* profile = allocate_1d_array_f(ox);
+  mem_set_tag(MEM_PROFIMG);
+  float** profimg = allocate_2d_array_f(ox, oy);
+  mem_set_tag(MEM_ENCODE_ROWS);
+  png_byte** rows = allocate_2d_array_pb(ox, oy, 16);
+  mem_set_tag(tag);
+
+  sample_bilinear(*dem->grid, sx, sy, fx, fy, ox, profile);
+  dem.reset();
+  render_profile(profile, ox, oy, profimg);
+  quantize_png_gray(ox, oy, TRUE, profimg, 0.0, 1.0, rows);
+  png_byte* png = nullptr;
+  size_t pnglen = 0;
+  const int status = write_png_rows_mem(ox, oy, 16, PNG_COLOR_TYPE_GRAY, -1, rows, &png, &pnglen);
+  free_2d_array_pb(rows);
+  free_2d_array_f(profimg);
+  free_1d_array_f(profile);
+  if (status != 0) return send_error(fd, "could not encode png");
+
+  char head[128];
+  bool ok = true;
+  if (format == "png") {
+    snprintf(head, sizeof(head), "{\"ok\":true,\"format\":\"png\",\"bytes\":%zu,\"ms\":%.3f}\n",
+             pnglen, 1000.0*(wall_seconds()-t0));
+    ok = send_all(fd, head, strlen(head)) && send_all(fd, png, pnglen);
+  } else {
+    // a fresh name in servedir, made readable by all so that a web server
+    // running as another user can pass it on; mkstemps alone makes it 0600
+    std::string path = servedir + "/makeprofile_XXXXXX.png";
+    const int tfd = mkstemps(&path[0], 4);
+    FILE* fp = nullptr;
+    if (tfd >= 0) {
+      if (fchmod(tfd, 0644) == 0) fp = fdopen(tfd, "wb");
+      if (!fp) close(tfd);
+    }
+    bool written = fp && fwrite(png, 1, pnglen, fp) == pnglen;
+    if (fp) written = (fclose(fp) == 0) && written;
+    if (!written) {
+      if (tfd >= 0) unlink(path.c_str());
+      ok = send_error(fd, "could not write in " + servedir);
+    } else {
+      snprintf(head, sizeof(head), ",\"ms\":%.3f}\n", 1000.0*(wall_seconds()-t0));
+      const std::string reply = "{\"ok\":true,\"format\":\"path\",\"path\":" + quote(path) + head;
+      ok = send_all(fd, reply.data(), reply.size());
+    }
+  }
+  free(png);
+  return ok;
+}
+
+//
+// a client connection: the reader thread splits what arrives into lines,
+// and one worker at a time answers them, so replies keep their order
+//
+struct Conn {
+  const int fd;
+  std::string partial;              // bytes after the last newline, reader only
+  std::deque<std::string> lines;    // complete requests not yet answered
+  bool busy = false;                // queued for, or held by, a worker
+  bool closed = false;              // the peer will send no more
+  bool dead = false;                // replies can no longer be sent
+  std::string error;                // answer this, then drop the connection
+  explicit Conn(const int _fd) : fd(_fd) {}
+  ~Conn() { close(fd); }
+};
+typedef std::shared_ptr<Conn> ConnPtr;
+
+char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+void stop_serving(int) {
+  unlink(socket_path);
+  _exit(0);
+}
+
+}
+
+int serve(const std::string& sockpath, const std::string& servedir, const DemEncoding& enc, const size_t budget,
+          const size_t nthreads) {
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (sockpath.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Socket path " << sockpath << " is too long\n";
+    return 1;
+  }
+  strncpy(addr.sun_path, sockpath.c_str(), sizeof(addr.sun_path)-1);
+  strncpy(socket_path, sockpath.c_str(), sizeof(socket_path)-1);
+  struct stat st;
+  if (stat(servedir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    std::cerr << "Serve directory " << servedir << " does not exist\n";
+    return 1;
+  }
+
+  const int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (lfd < 0) {
+    perror("Could not create socket");
+    return 1;
+  }
+  // a socket left by an earlier server that was killed
+  if (stat(sockpath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(sockpath.c_str());
+  if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 64) != 0) {
+    perror(("Could not listen on " + sockpath).c_str());
+    close(lfd);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stop_serving);
+  signal(SIGTERM, stop_serving);
+
+  // workers take one request at a time from connections with work; a
+  // connection goes to the back of the queue after each, so a busy client
+  // can not hold a worker while others wait, and an idle one holds none
+  DemCache cache(enc, budget);
+  std::mutex qmtx;
+  std::condition_variable qcv;
+  std::deque<ConnPtr> ready;
+  const size_t nw = default_threads(nthreads);
+  std::vector<std::thread> workers;
+  for (size_t w=0; w<nw; ++w) {
+    workers.emplace_back([&]() {
+      while (true) {
+        ConnPtr c;
+        std::string line, error;
+        {
+          std::unique_lock<std::mutex> lock(qmtx);
+          qcv.wait(lock, [&]() { return !ready.empty(); });
+          c = ready.front();
+          ready.pop_front();
+          if (!c->lines.empty()) {
+            line = c->lines.front();
+            c->lines.pop_front();
+          } else {
+            error = c->error;
+          }
+        }
+        bool ok = true;
+        if (!line.empty()) {
+          ok = handle_request(c->fd, line, servedir, cache);
+        } else {
+          (void) send_error(c->fd, error);
+          ok = false;
+        }
+        std::lock_guard<std::mutex> lock(qmtx);
+        if (!ok) c->dead = true;
+        if (!c->dead && (!c->lines.empty() || !c->error.empty())) {
+          ready.push_back(c);
+          qcv.notify_one();
+        } else {
+          c->busy = false;
+        }
+      }
+    });
+  }
+
+  // this thread accepts and reads every connection
+  const size_t maxline = 1 << 16;
+  const size_t maxpending = 64;
+  const time_t sendtimeout = 5;
+  std::vector<ConnPtr> conns;
+  std::vector<struct pollfd> pfds;
+  std::vector<ConnPtr> polled;
+  char buf[1 << 16];
+  std::cout << "Serving profiles on " << sockpath << " with " << nw << " workers" << std::endl;
+  while (true) {
+    pfds.assign(1, {lfd, POLLIN, 0});
+    polled.clear();
+    {
+      std::lock_guard<std::mutex> lock(qmtx);
+      // forget connections that are finished; workers keep theirs open
+      conns.erase(std::remove_if(conns.begin(), conns.end(), [](const ConnPtr& c) {
+        return c->dead || c->closed || !c->error.empty();
+      }), conns.end());
+      // stop reading from a client that is far ahead of its answers
+      for (const ConnPtr& c : conns) {
+        if (c->lines.size() >= maxpending) continue;
+        pfds.push_back({c->fd, POLLIN, 0});
+        polled.push_back(c);
+      }
+    }
+    // wake now and then to resume reading paused clients
+    const int n = poll(pfds.data(), pfds.size(), 100);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("Could not poll connections");
+      break;
+    }
+
+    if (pfds[0].revents & POLLIN) {
+      const int fd = accept(lfd, nullptr, nullptr);
+      if (fd >= 0) {
+        // a client that stops reading its replies gives up its worker
+        // after this long instead of holding it for good
+        struct timeval tv = {sendtimeout, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        conns.push_back(std::make_shared<Conn>(fd));
+      }
+      else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+        perror("Could not accept connection");
+        break;
+      }
+    }
+
+    for (size_t k=0; k<polled.size(); ++k) {
+      if (!pfds[k+1].revents) continue;
+      const ConnPtr& c = polled[k];
+      const ssize_t got = recv(c->fd, buf, sizeof(buf), 0);
+      if (got < 0 && errno == EINTR) continue;
+
+      std::vector<std::string> lines;
+      if (got > 0) {
+        c->partial.append(buf, got);
+        size_t nl;
+        while ((nl = c->partial.find('\n')) != std::string::npos) {
+          std::string line = c->partial.substr(0, nl);
+          c->partial.erase(0, nl+1);
+          if (line.find_first_not_of(" \t\r") != std::string::npos) lines.push_back(line);
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(qmtx);
+      for (std::string& line : lines) c->lines.push_back(std::move(line));
+      if (got <= 0) c->closed = true;
+      else if (c->partial.size() > maxline) c->error = "request line too long";
+      if (!c->busy && (!c->lines.empty() || !c->error.empty())) {
+        c->busy = true;
+        ready.push_back(c);
+        qcv.notify_one();
+      }
+    }
+  }
+
+  // only reached if accept or poll fails for good; workers never return
+  close(lfd);
+  unlink(sockpath.c_str());
+  for (auto& w : workers) w.detach();
+  return 1;
+}
@@ -0,0 +1,25 @@
+//
+// serve.h - answer profile requests over a unix socket, with dems kept resident
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "dem.h"
+
+#include <string>
+#include <cstddef>
+
+// listen on the unix socket at sockpath until killed; each connection
+// sends one json request per line, such as
+//   {"dem":"a.png","px":0.5,"py":0.5,"angle":30,"ox":1000,"oy":400,"format":"png"}
+// and gets back one json line per request: for "png", one with "bytes"
+// followed by that many bytes of png, and for "path", one with the "path"
+// of a new png in servedir, readable by all; clients can not choose where
+// the server writes; decoded dems stay in memory,
+// least recently used first out, within budget bytes; one thread reads
+// every connection and nthreads workers answer requests one at a time,
+// each connection's in order; returns nonzero if the socket can not be opened
+int serve(const std::string& sockpath, const std::string& servedir, const DemEncoding& enc, const size_t budget,
+          const size_t nthreads);
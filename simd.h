@@ -0,0 +1,16 @@
+/*
+ * simd.h - helpers for vectorized kernels, usable from C and C++
+ *
+ * Copyright 2023 Mark J. Stock <markjstock@gmail.com>
+ */
+
+#pragma once
+
+// on x86-64 with gcc, build avx2 and sse4.1 copies of a hot kernel next to
+// the baseline one and pick between them when the program loads, so the
+// vectorizer can use wide integer ops without raising the minimum cpu
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define SIMD_CLONES __attribute__((target_clones("avx2","sse4.1","default")))
+#else
+#define SIMD_CLONES
+#endif
@@ -0,0 +1,45 @@
+//
+// strip.cpp - the dem under a line, rotated to lie along it
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "strip.h"
+#include "memory.h"
+#include "inout.h"
+
+#include <iostream>
+#include <cstdio>
+
+static bool ends_with(const std::string& s, const std::string& tail) {
+  return s.size() >= tail.size() && s.compare(s.size()-tail.size(), tail.size(), tail) == 0;
+}
+
+void write_strip(const LineSet& lines, const std::string& filename) {
+  const size_t ox = lines.ox;
+  const size_t rows = lines.nlines;
+
+  if (ends_with(filename, ".raw") || ends_with(filename, ".f32")) {
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (!fp) {
+      std::cerr << "Could not open output file " << filename << "\n";
+      exit(0);
+    }
+    for (size_t r=0; r<rows; ++r) {
+      fwrite(lines.vals.data() + (rows-1-r)*ox, sizeof(float), ox, fp);
+    }
+    fclose(fp);
+    std::cout << "Wrote " << ox << " x " << rows << " floats to " << filename << std::endl;
+    return;
+  }
+
+  // each line is already one row of the grid, so copy it in as columns
+  float** grid = allocate_2d_array_f(ox, rows);
+  for (size_t l=0; l<rows; ++l) {
+    for (size_t i=0; i<ox; ++i) grid[i][l] = lines.vals[l*ox + i];
+  }
+  std::cout << "Writing " << ox << " x " << rows << " strip to " << filename << std::endl;
+  (void) write_png (filename.c_str(), (int)ox, (int)rows, FALSE, TRUE,
+                    grid, 0.0, 1.0, nullptr, 0.0, 1.0, nullptr, 0.0, 1.0);
+  free_2d_array_f(grid);
+}
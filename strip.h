@@ -0,0 +1,16 @@
+//
+// strip.h - the dem under a line, rotated to lie along it
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "swath.h"
+
+#include <string>
+
+// write parallel lines as a grid, one row per line with the last line's
+// row on top: as 32-bit floats in rows, top row first, when the name ends
+// in .raw or .f32, otherwise as a 16-bit png of values 0..1
+void write_strip(const LineSet& lines, const std::string& filename);
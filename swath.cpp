@@ -0,0 +1,114 @@
+//
+// swath.cpp - profiles reduced across a band of parallel lines
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "swath.h"
+#include "profile.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+// linear-interpolated percentile of a sorted list
+static float percentile(const float* sorted, const size_t n, const float pct) {
+  const float pos = std::max(0.f, std::min(1.f, pct/100.f)) * (n-1);
+  const size_t k = std::min(n-1, (size_t)pos);
+  const size_t k1 = std::min(n-1, k+1);
+  return sorted[k] + (pos-k) * (sorted[k1]-sorted[k]);
+}
+
+void sample_parallel_lines(DemGrid& grid, const float sx, const float sy,
+                           const float fx, const float fy, const size_t ox,
+                           const float off0, const float off1, const size_t nlines,
+                           const size_t nthreads, LineSet& lines) {
+
+  // unit normal to the line
+  const float len = std::hypot(fx-sx, fy-sy);
+  const float nxv = -(fy-sy) / len;
+  const float nyv =  (fx-sx) / len;
+  const float xmax = grid.nx;
+  const float ymax = grid.ny;
+
+  // one row of samples per line, and whether each is on the dem
+  lines.nlines = nlines;
+  lines.ox = ox;
+  lines.vals.resize(nlines * ox);
+  lines.ondem.resize(nlines * ox);
+  parallel_for(nlines, nthreads, [&](const size_t l) {
+    TraceSpan span("line", l);
+    const float off = (nlines > 1) ? off0 + (off1-off0) * l / (nlines-1) : 0.5f*(off0+off1);
+    std::vector<float> tx(ox), ty(ox);
+    float* row = lines.vals.data() + l*ox;
+    unsigned char* ok = lines.ondem.data() + l*ox;
+    for (size_t i=0; i<ox; ++i) {
+      const float wgt = (i+0.5f)/ox;
+      tx[i] = sx*(1.0f-wgt) + fx*wgt + off*nxv;
+      ty[i] = sy*(1.0f-wgt) + fy*wgt + off*nyv;
+      ok[i] = (tx[i] >= 0.f && ty[i] >= 0.f && tx[i] <= xmax && ty[i] <= ymax);
+    }
+    sample_points(grid, tx.data(), ty.data(), ox, row);
+    for (size_t i=0; i<ox; ++i) if (!ok[i]) row[i] = 0.f;
+  });
+}
+
+void normal_extent(const DemGrid& grid, const float sx, const float sy,
+                   const float fx, const float fy, float& off0, float& off1) {
+  const float len = std::hypot(fx-sx, fy-sy);
+  const float nxv = -(fy-sy) / len;
+  const float nyv =  (fx-sx) / len;
+  const float cx[4] = {0.f, (float)grid.nx, 0.f, (float)grid.nx};
+  const float cy[4] = {0.f, 0.f, (float)grid.ny, (float)grid.ny};
+  off0 = std::numeric_limits<float>::max();
+  off1 = -off0;
+  for (int c=0; c<4; ++c) {
+    const float d = (cx[c]-sx)*nxv + (cy[c]-sy)*nyv;
+    off0 = std::min(off0, d);
+    off1 = std::max(off1, d);
+  }
+}
+
+void sample_swath(DemGrid& grid, const float sx, const float sy,
+                  const float fx, const float fy, const size_t ox,
+                  const float width, const size_t nlines,
+                  const float pctlo, const float pcthi,
+                  const size_t nthreads, SwathStats& stats) {
+
+  LineSet lines;
+  sample_parallel_lines(grid, sx, sy, fx, fy, ox, -0.5f*width, 0.5f*width, nlines, nthreads, lines);
+  const std::vector<float>& vals = lines.vals;
+  const std::vector<unsigned char>& ondem = lines.ondem;
+
+  stats.min.assign(ox, 0.f);
+  stats.lo.assign(ox, 0.f);
+  stats.mean.assign(ox, 0.f);
+  stats.hi.assign(ox, 0.f);
+  stats.max.assign(ox, 0.f);
+
+  // reduce each station, in parallel over blocks of stations
+  const size_t block = 256;
+  parallel_for((ox+block-1)/block, nthreads, [&](const size_t b) {
+    std::vector<float> col(nlines);
+    for (size_t i=b*block; i<std::min(ox, (b+1)*block); ++i) {
+      size_t n = 0;
+      float sum = 0.f;
+      for (size_t l=0; l<nlines; ++l) {
+        if (!ondem[l*ox + i]) continue;
+        const float v = vals[l*ox + i];
+        col[n++] = v;
+        sum += v;
+      }
+      if (n == 0) continue;
+      std::sort(col.begin(), col.begin()+n);
+      stats.min[i] = col[0];
+      stats.max[i] = col[n-1];
+      stats.mean[i] = sum / n;
+      stats.lo[i] = percentile(col.data(), n, pctlo);
+      stats.hi[i] = percentile(col.data(), n, pcthi);
+    }
+  });
+}
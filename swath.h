@@ -0,0 +1,48 @@
+//
+// swath.h - profiles reduced across a band of parallel lines
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "dem.h"
+
+#include <vector>
+#include <cstddef>
+
+// samples along a set of parallel lines, line l at vals[l*ox + i], with
+// ondem[l*ox + i] set where the sample fell on the dem
+struct LineSet {
+  size_t nlines = 0, ox = 0;
+  std::vector<float> vals;
+  std::vector<unsigned char> ondem;
+};
+
+// sample nlines lines parallel to the one from (sx,sy) to (fx,fy), at the
+// same ox stations, offset along its left-hand normal by evenly spaced
+// amounts from off0 to off1 cells; off-dem samples read 0
+void sample_parallel_lines(DemGrid& grid, const float sx, const float sy,
+                           const float fx, const float fy, const size_t ox,
+                           const float off0, const float off1, const size_t nlines,
+                           const size_t nthreads, LineSet& lines);
+
+// range of normal offsets, relative to the line from (sx,sy) to (fx,fy),
+// over which parallel lines still cross the grid
+void normal_extent(const DemGrid& grid, const float sx, const float sy,
+                   const float fx, const float fy, float& off0, float& off1);
+
+// per-station statistics across the lines of a swath
+struct SwathStats {
+  std::vector<float> min, lo, mean, hi, max;
+};
+
+// sample nlines lines parallel to the one from (sx,sy) to (fx,fy), evenly
+// spread over a corridor width cells wide, at the same ox stations, and
+// reduce each station to min, mean, max and the pctlo/pcthi percentiles;
+// samples falling off the dem are left out
+void sample_swath(DemGrid& grid, const float sx, const float sy,
+                  const float fx, const float fy, const size_t ox,
+                  const float width, const size_t nlines,
+                  const float pctlo, const float pcthi,
+                  const size_t nthreads, SwathStats& stats);
@@ -0,0 +1,188 @@
+//
+// test_serve.cpp - run makeprofile --serve and check that bad dems and idle or stalled clients do not stop it
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+static const char* dempng = "FranceLesArcs.png";
+
+// one connection to the server, reading replies a line at a time
+class Client {
+public:
+  explicit Client(const std::string& sockpath, const int timeout = 5) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sockpath.c_str(), sizeof(addr.sun_path)-1);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      close(fd);
+      fd = -1;
+      return;
+    }
+    // a reply that never comes fails the test rather than hanging it
+    struct timeval tv = {timeout, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+  ~Client() { if (fd >= 0) close(fd); }
+  bool connected() const { return fd >= 0; }
+
+  // send one request without reading its reply
+  bool send_only(const std::string& json) {
+    const std::string line = json + "\n";
+    return send(fd, line.data(), line.size(), MSG_NOSIGNAL) == (ssize_t)line.size();
+  }
+
+  // send one request and return the reply line, skipping any png bytes
+  std::string request(const std::string& json) {
+    if (!send_only(json)) return "";
+    std::string reply;
+    char c;
+    while (read_bytes(&c, 1) && c != '\n') reply += c;
+    const size_t at = reply.find("\"bytes\":");
+    if (at != std::string::npos) {
+      size_t n = strtoul(reply.c_str()+at+8, nullptr, 10);
+      std::vector<char> png(n);
+      if (!read_bytes(png.data(), n)) return "";
+      if (n < 8 || memcmp(png.data(), "\x89PNG", 4) != 0) return "";
+    }
+    return reply;
+  }
+
+private:
+  bool read_bytes(char* p, size_t n) {
+    while (n > 0) {
+      const ssize_t got = recv(fd, p, n, 0);
+      if (got < 0 && errno == EINTR) continue;
+      if (got <= 0) return false;
+      p += got;
+      n -= got;
+    }
+    return true;
+  }
+  int fd;
+};
+
+static int failed = 0;
+
+static void expect(const std::string& what, const std::string& reply, const std::string& want) {
+  const bool ok = reply.find(want) != std::string::npos;
+  printf("  %-44s %s\n", what.c_str(), ok ? "ok" : "FAIL");
+  if (!ok) {
+    printf("    got: %s\n", reply.c_str());
+    ++failed;
+  }
+}
+
+static std::string dem_request(const std::string& path) {
+  return "{\"dem\":\"" + path + "\",\"angle\":30,\"ox\":300,\"oy\":100}";
+}
+
+int main() {
+  const std::string dir = "/tmp/makeprofile_test_" + std::to_string(getpid());
+  const std::string sockpath = dir + ".sock";
+  const std::string truncated = dir + "_truncated.png";
+  const std::string corrupt = dir + "_corrupt.png";
+
+  // a valid signature and header, then nothing, and a body of garbage
+  std::ifstream is(dempng, std::ios::binary);
+  std::stringstream ss;
+  ss << is.rdbuf();
+  const std::string png = ss.str();
+  if (png.size() < 4096) {
+    std::cerr << "Could not read " << dempng << "\n";
+    return 1;
+  }
+  std::ofstream(truncated, std::ios::binary) << png.substr(0, png.size()/3);
+  std::string bad = png;
+  for (size_t k=bad.size()/4; k<bad.size()/2; ++k) bad[k] = (char)(k*131);
+  std::ofstream(corrupt, std::ios::binary) << bad;
+
+  const pid_t pid = fork();
+  if (pid == 0) {
+    if (!freopen("/dev/null", "w", stdout)) _exit(1);
+    execl("./makeprofile.bin", "makeprofile.bin", "--serve", sockpath.c_str(), "-t", "2", (char*)nullptr);
+    _exit(127);
+  }
+
+  // wait for the socket
+  bool up = false;
+  for (int k=0; k<200 && !up; ++k) {
+    usleep(20000);
+    up = Client(sockpath).connected();
+  }
+  if (!up) {
+    std::cerr << "Server did not start on " << sockpath << "\n";
+    kill(pid, SIGTERM);
+    return 1;
+  }
+
+  {
+    Client c(sockpath);
+    expect("truncated png is an error", c.request(dem_request(truncated)), "\"ok\":false");
+    expect("same connection still answers", c.request(dem_request(dempng)), "\"ok\":true");
+    expect("corrupt png is an error", c.request(dem_request(corrupt)), "\"ok\":false");
+    expect("missing png is an error", c.request(dem_request(dir + "_none.png")), "\"ok\":false");
+    expect("not a png is an error", c.request(dem_request("README.md")), "\"ok\":false");
+    expect("same connection still answers", c.request(dem_request(dempng)), "\"ok\":true");
+    expect("client-chosen output file is refused",
+           c.request("{\"dem\":\"" + std::string(dempng) + "\",\"format\":\"path\",\"out\":\"" + truncated + "\"}"),
+           "\"ok\":false");
+  }
+  {
+    Client c(sockpath);
+    expect("new connection is accepted", c.connected() ? "connected" : "", "connected");
+    if (c.connected()) expect("new connection answers", c.request(dem_request(dempng)), "\"ok\":true");
+  }
+  {
+    // more idle clients than workers must not keep a new one waiting
+    std::vector<std::unique_ptr<Client>> idle;
+    for (int k=0; k<4; ++k) idle.emplace_back(new Client(sockpath));
+    Client c(sockpath);
+    expect("answers past idle connections", c.request(dem_request(dempng)), "\"ok\":true");
+    expect("idle connections still answer", idle[0]->request(dem_request(dempng)), "\"ok\":true");
+  }
+  {
+    // one client per worker that never reads its replies; a few of these
+    // fill its socket, after which the worker is stuck in send until the
+    // server's send timeout gives up on that client
+    std::vector<std::unique_ptr<Client>> slow;
+    for (int k=0; k<2; ++k) {
+      slow.emplace_back(new Client(sockpath));
+      for (int r=0; r<16; ++r) slow.back()->send_only("{\"dem\":\"" + std::string(dempng) + "\",\"ox\":2000,\"oy\":2000}");
+    }
+    sleep(3);
+    Client c(sockpath, 20);
+    expect("answers past clients that do not read", c.request(dem_request(dempng)), "\"ok\":true");
+  }
+
+  kill(pid, SIGTERM);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  unlink(truncated.c_str());
+  unlink(corrupt.c_str());
+
+  if (failed > 0) {
+    printf("%d serve test%s failed\n", failed, failed > 1 ? "s" : "");
+    return 1;
+  }
+  printf("All serve tests passed\n");
+  return 0;
+}
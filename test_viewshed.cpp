@@ -0,0 +1,166 @@
+//
+// test_viewshed.cpp - check the R2 viewshed against a ray to every cell
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "memory.h"
+#include "dem.h"
+#include "viewshed.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+// repeatable uniform floats in [0,1)
+static float uniform(uint64_t& state) {
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (float)(state >> 40) / (float)(1ULL << 24);
+}
+
+//
+// the exact answer R2 approximates: a ray from the eye to the cell's
+// own center, sampled bilinearly at every row or column it crosses; the
+// cell is visible if the sight line to it is at least as steep as every
+// one of those samples
+//
+static std::vector<char> brute_force(DemGrid& grid, const Observer& obs) {
+  const int64_t nx = grid.nx;
+  const int64_t ny = grid.ny;
+  DemSampler ds(grid);
+  const int64_t x0 = std::lround(obs.x);
+  const int64_t y0 = std::lround(obs.y);
+  const double zscale = obs.zhi - obs.zlo;
+  const double zeye = obs.zlo + zscale*ds.at(x0, y0) + obs.height;
+  auto slope = [&](const double z, const double d) {
+    return (obs.zlo + zscale*z - zeye) / (d*obs.cellsize);
+  };
+
+  std::vector<char> vis(nx*ny, 1);
+  for (int64_t i=0; i<nx; ++i) {
+    for (int64_t j=0; j<ny; ++j) {
+      const int64_t dx = i - x0;
+      const int64_t dy = j - y0;
+      const int64_t n = std::max(std::abs(dx), std::abs(dy));
+      if (n == 0) continue;
+      const double step = std::hypot((double)dx, (double)dy) / n;
+      double best = -1.e+30;
+      for (int64_t k=1; k<n; ++k) {
+        best = std::max(best, slope(ds.bilinear(x0 + (float)dx*k/n, y0 + (float)dy*k/n), k*step));
+      }
+      vis[i*ny+j] = (slope(ds.at(i, j), n*step) >= best);
+    }
+  }
+  return vis;
+}
+
+//
+// run the viewshed over one synthetic dem and compare it cell by cell;
+// R2 decides each cell from the ray that passes nearest it rather than
+// one aimed at it, so it can only be wrong where the exact answer flips
+// within one cell, and on terrain without shadows it must be exact
+//
+static bool check(const std::string& name, const int64_t nx, const int64_t ny, const bool shadows,
+                  const std::function<float(int64_t, int64_t)>& height) {
+  float** dem = allocate_2d_array_f(nx, ny);
+  for (int64_t i=0; i<nx; ++i) {
+    for (int64_t j=0; j<ny; ++j) dem[i][j] = height(i, j);
+  }
+  InCoreDem grid(dem, nx, ny);
+  Observer obs;
+  obs.x = 0.37f * nx;
+  obs.y = 0.55f * ny;
+  obs.zlo = 0.f;
+  obs.zhi = 1000.f;
+  obs.cellsize = 10.f;
+  obs.height = 2.f;
+
+  unsigned char* vis = viewshed(grid, obs, 2);
+  const std::vector<char> exact = brute_force(grid, obs);
+
+  int64_t wrong = 0, offedge = 0, hidden = 0, edges = 0;
+  for (int64_t i=0; i<nx; ++i) {
+    for (int64_t j=0; j<ny; ++j) {
+      const char want = exact[i*ny+j];
+      if (!want) ++hidden;
+      // cells with a neighbor of the other answer line the shadow edges
+      bool edge = false;
+      for (int64_t a=std::max((int64_t)0, i-1); a<=std::min(nx-1, i+1); ++a) {
+        for (int64_t b=std::max((int64_t)0, j-1); b<=std::min(ny-1, j+1); ++b) {
+          edge = edge || (exact[a*ny+b] != want);
+        }
+      }
+      if (edge) ++edges;
+      if ((bool)vis[j*nx+i] == (bool)want) continue;
+      ++wrong;
+      if (!edge) ++offedge;
+    }
+  }
+  mem_free(vis);
+  free_2d_array_f(dem);
+
+  const double agree = 1.0 - (double)wrong / (nx*ny);
+  // the ray R2 tests passes within half a cell of the one aimed at a cell,
+  // so away from the shadow edges both must agree; along them only cells
+  // whose true horizon passes that close may differ, which on these grids
+  // is a few in a hundred edge cells, so allow one in ten
+  const bool ok = shadows ? (offedge == 0 && 10*(wrong-offedge) <= edges && hidden > 0) : (wrong == 0);
+  printf("  %-6s %4ld x %-4ld %6.2f%% hidden, %6.3f%% agree, %ld of %ld edge cells differ, %ld off an edge  %s\n",
+         name.c_str(), (long)nx, (long)ny, 100.0*hidden/(nx*ny), 100.0*agree, (long)(wrong-offedge),
+         (long)edges, (long)offedge, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main() {
+  const int64_t nx = 201, ny = 151;
+  int failed = 0;
+
+  // nothing in the way: every cell is visible
+  failed += !check("flat", nx, ny, false, [](int64_t, int64_t) { return 0.2f; });
+
+  // the observer at the bottom of a bowl sees all of it
+  failed += !check("pit", nx, ny, false, [&](int64_t i, int64_t j) {
+    const float r = std::hypot((float)i - 0.37f*nx, (float)j - 0.55f*ny);
+    return 0.1f + 2.e-5f*r*r;
+  });
+
+  // a straight ridge across the grid hides the far side
+  failed += !check("ridge", nx, ny, true, [&](int64_t i, int64_t j) {
+    const float d = (float)i - 0.6f*nx - 0.2f*(j - 0.5f*ny);
+    return 0.1f + 0.3f*std::exp(-d*d/18.f);
+  });
+
+  // rough terrain: octaves of bilinear value noise on a random lattice
+  std::vector<std::vector<float>> octaves;
+  uint64_t rng = 2023;
+  for (int o=0; o<6; ++o) {
+    std::vector<float> lat(65*65);
+    for (float& v : lat) v = uniform(rng);
+    octaves.push_back(lat);
+  }
+  failed += !check("fbm", nx, ny, true, [&](int64_t i, int64_t j) {
+    float sum = 0.f, amp = 0.5f, freq = 2.f / nx;
+    for (const std::vector<float>& lat : octaves) {
+      const float x = std::fmod(i*freq, 64.f), y = std::fmod(j*freq, 64.f);
+      const int ix = (int)x, iy = (int)y;
+      const float fx = x-ix, fy = y-iy;
+      sum += amp * ((1-fx)*(1-fy)*lat[ix*65+iy] + fx*(1-fy)*lat[(ix+1)*65+iy] +
+                    (1-fx)*fy*lat[ix*65+iy+1] + fx*fy*lat[(ix+1)*65+iy+1]);
+      amp *= 0.5f;
+      freq *= 2.f;
+    }
+    return sum;
+  });
+
+  if (failed > 0) {
+    printf("%d viewshed test%s failed\n", failed, failed > 1 ? "s" : "");
+    return 1;
+  }
+  printf("All viewshed tests passed\n");
+  return 0;
+}
@@ -0,0 +1,14 @@
+//
+// timer.h - wall-clock timing
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <chrono>
+
+// seconds on a monotonic clock, from an arbitrary start
+inline double wall_seconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,113 @@
+//
+// timings.cpp - per-phase wall time, throughput and peak memory
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "timings.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <cstdio>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+Timings::Timings() : created(wall_seconds()) {}
+
+void Timings::begin(const std::string& name) {
+  Phase p;
+  p.name = name;
+  if (counters) p.at = counters->read();
+  p.start = wall_seconds();
+  phases.push_back(p);
+}
+
+void Timings::end(const double work, const std::string& unit, const double bytes) {
+  if (phases.empty()) return;
+  Phase& p = phases.back();
+  p.seconds = wall_seconds() - p.start;
+  if (counters) p.counts = PerfCounters::delta(p.at, counters->read());
+  trace_complete(p.name, p.start, p.start + p.seconds);
+  if (bytes > 0.0) {
+    iobytes += bytes;
+    trace_counter("io bytes", iobytes);
+  }
+  p.work = work;
+  p.unit = unit;
+  p.bytes = bytes;
+}
+
+size_t Timings::peak_rss() {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+  // linux reports kilobytes
+  return (size_t)ru.ru_maxrss * 1024;
+}
+
+double Timings::file_bytes(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return 0.0;
+  return (double)st.st_size;
+}
+
+void Timings::report(std::ostream& os, const bool json) const {
+  const double total = wall_seconds() - created;
+  const double rssmb = peak_rss() / 1048576.0;
+  char buf[256];
+
+  if (json) {
+    os << "{\"phases\":[";
+    for (size_t k=0; k<phases.size(); ++k) {
+      const Phase& p = phases[k];
+      snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"seconds\":%.6f", k ? "," : "", p.name.c_str(), p.seconds);
+      os << buf;
+      if (p.bytes > 0.0 && p.seconds > 0.0) {
+        snprintf(buf, sizeof(buf), ",\"mb_per_s\":%.3f", p.bytes / p.seconds / 1.e+6);
+        os << buf;
+      }
+      if (p.work > 0.0 && p.seconds > 0.0) {
+        snprintf(buf, sizeof(buf), ",\"m%s_per_s\":%.3f", p.unit.c_str(), p.work / p.seconds / 1.e+6);
+        os << buf;
+      }
+      for (int e=0; e<PERF_NEVENTS; ++e) {
+        if (p.counts.count[e] < 0) continue;
+        os << ",\"" << perf_event_name(e) << "\":" << p.counts.count[e];
+      }
+      os << "}";
+    }
+    snprintf(buf, sizeof(buf), "],\"total_seconds\":%.6f,\"peak_rss_mb\":%.1f}", total, rssmb);
+    os << buf << std::endl;
+    return;
+  }
+
+  os << "Timings:\n";
+  for (const Phase& p : phases) {
+    snprintf(buf, sizeof(buf), "  %-10s %10.6f s", p.name.c_str(), p.seconds);
+    os << buf;
+    if (p.bytes > 0.0 && p.seconds > 0.0) {
+      snprintf(buf, sizeof(buf), "  %9.2f MB/s", p.bytes / p.seconds / 1.e+6);
+      os << buf;
+    }
+    if (p.work > 0.0 && p.seconds > 0.0) {
+      snprintf(buf, sizeof(buf), "  %9.2f M%s/s", p.work / p.seconds / 1.e+6, p.unit.c_str());
+      os << buf;
+    }
+    os << "\n";
+    if (p.counts.any()) {
+      os << "  " << std::string(10, ' ');
+      for (int e=0; e<PERF_NEVENTS; ++e) {
+        if (p.counts.count[e] < 0) continue;
+        os << " " << perf_event_name(e) << " " << p.counts.count[e];
+      }
+      const int64_t cyc = p.counts.count[PERF_CYCLES];
+      const int64_t ins = p.counts.count[PERF_INSTRUCTIONS];
+      if (cyc > 0 && ins >= 0) {
+        snprintf(buf, sizeof(buf), " ipc %.2f", (double)ins / cyc);
+        os << buf;
+      }
+      os << "\n";
+    }
+  }
+  snprintf(buf, sizeof(buf), "  %-10s %10.6f s  peak RSS %.1f MB\n", "total", total, rssmb);
+  os << buf;
+}
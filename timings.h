@@ -0,0 +1,49 @@
+//
+// timings.h - per-phase wall time, throughput and peak memory
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "perfcounters.h"
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+
+// wall time of named phases of a run; phases run one after another
+class Timings {
+public:
+  Timings();
+
+  // also count hardware events in each phase
+  void use_counters(const PerfCounters* _counters) { counters = _counters; }
+
+  // start and stop a phase; work is how many units it processed, in
+  // unit ("pix", "samples", ...), and bytes how much data it read or wrote
+  void begin(const std::string& name);
+  void end(const double work = 0.0, const std::string& unit = "", const double bytes = 0.0);
+
+  // every phase with its rate and any event counts, the total and the
+  // peak resident memory, as aligned text or as one line of json
+  void report(std::ostream& os, const bool json) const;
+
+  // largest resident set so far, from getrusage
+  static size_t peak_rss();
+
+  // size of a file, or 0 if it can not be read
+  static double file_bytes(const std::string& path);
+
+private:
+  struct Phase {
+    std::string name, unit;
+    double start = 0.0, seconds = 0.0, work = 0.0, bytes = 0.0;
+    PerfCounts at, counts;
+  };
+  std::vector<Phase> phases;
+  double created;
+  double iobytes = 0.0;
+  const PerfCounters* counters = nullptr;
+};
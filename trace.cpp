@@ -0,0 +1,126 @@
+//
+// trace.cpp - chrome/perfetto trace events from any thread
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "trace.h"
+#include "timer.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+
+std::atomic<bool> trace_on(false);
+
+namespace {
+
+struct TraceEvent {
+  std::string name;
+  char ph;
+  double ts, dur;
+  int64_t arg;
+  double value;
+};
+
+// one per thread that ever traced; only its own thread appends to it,
+// and the threads have all been joined by the time it is written out
+struct TraceBuffer {
+  int tid;
+  std::vector<TraceEvent> events;
+};
+
+std::mutex registry_lock;
+std::vector<std::unique_ptr<TraceBuffer>> registry;
+std::string trace_path;
+double trace_t0 = 0.0;
+
+// the lock is only taken on a thread's first event
+TraceBuffer& local_buffer() {
+  thread_local TraceBuffer* buf = nullptr;
+  if (!buf) {
+    std::lock_guard<std::mutex> lock(registry_lock);
+    registry.emplace_back(new TraceBuffer());
+    buf = registry.back().get();
+    buf->tid = (int)registry.size();
+    buf->events.reserve(1024);
+  }
+  return *buf;
+}
+
+// microseconds since tracing started
+double micros(const double t) { return 1.e+6 * (t - trace_t0); }
+
+void json_string(FILE* fp, const std::string& s) {
+  fputc('"', fp);
+  for (const char c : s) {
+    if (c == '"' || c == '\\') fputc('\\', fp);
+    fputc(c, fp);
+  }
+  fputc('"', fp);
+}
+
+}
+
+void trace_start(const std::string& path) {
+  trace_path = path;
+  trace_t0 = wall_seconds();
+  // the main thread registers first, as tid 1
+  (void) local_buffer();
+  trace_on.store(true);
+  std::atexit(trace_flush);
+}
+
+void trace_complete(const std::string& name, const double t0, const double t1, const int64_t arg) {
+  if (!trace_enabled()) return;
+  local_buffer().events.push_back(TraceEvent{name, 'X', micros(t0), 1.e+6*(t1-t0), arg, 0.0});
+}
+
+void trace_counter(const std::string& name, const double value) {
+  if (!trace_enabled()) return;
+  local_buffer().events.push_back(TraceEvent{name, 'C', micros(wall_seconds()), 0.0, -1, value});
+}
+
+void trace_flush() {
+  if (!trace_enabled()) return;
+  trace_on.store(false);
+
+  FILE* fp = fopen(trace_path.c_str(), "w");
+  if (!fp) {
+    fprintf(stderr, "Could not write trace to %s\n", trace_path.c_str());
+    return;
+  }
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  size_t nevents = 0;
+  for (const auto& buf : registry) {
+    fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+            first ? "" : ",\n", buf->tid, buf->tid == 1 ? "main" : "worker", buf->tid);
+    first = false;
+    for (const TraceEvent& ev : buf->events) {
+      fprintf(fp, ",\n{\"name\":");
+      json_string(fp, ev.name);
+      fprintf(fp, ",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", ev.ph, buf->tid, ev.ts);
+      if (ev.ph == 'X') {
+        fprintf(fp, ",\"dur\":%.3f", ev.dur);
+        if (ev.arg >= 0) fprintf(fp, ",\"args\":{\"index\":%lld}", (long long)ev.arg);
+      } else {
+        fprintf(fp, ",\"args\":{\"value\":%.17g}", ev.value);
+      }
+      fputc('}', fp);
+    }
+    nevents += buf->events.size();
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+  printf("  wrote %zu trace events from %zu threads to %s\n", nevents, registry.size(), trace_path.c_str());
+}
+
+TraceSpan::TraceSpan(const char* _name, const int64_t _arg)
+  : name(_name), arg(_arg), t0(trace_enabled() ? wall_seconds() : 0.0) {}
+
+TraceSpan::~TraceSpan() {
+  if (trace_enabled()) trace_complete(name, t0, wall_seconds(), arg);
+}
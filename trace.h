@@ -0,0 +1,42 @@
+//
+// trace.h - chrome/perfetto trace events from any thread
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+extern std::atomic<bool> trace_on;
+
+// whether trace_start was called; the only cost when tracing is off
+inline bool trace_enabled() { return trace_on.load(std::memory_order_relaxed); }
+
+// start recording; every thread appends to its own buffer, and all of
+// them are written to this file as trace event json at exit
+void trace_start(const std::string& path);
+
+// a span from t0 to t1 (wall_seconds) on the calling thread, with an
+// optional index such as the line or frame number
+void trace_complete(const std::string& name, const double t0, const double t1,
+                    const int64_t arg = -1);
+
+// a value to plot over time, such as items left in a queue
+void trace_counter(const std::string& name, const double value);
+
+// write out every thread's events; called at exit
+void trace_flush();
+
+// traces the scope it lives in
+class TraceSpan {
+public:
+  explicit TraceSpan(const char* _name, const int64_t _arg = -1);
+  ~TraceSpan();
+private:
+  const char* name;
+  const int64_t arg;
+  double t0;
+};
@@ -0,0 +1,55 @@
+//
+// traverse.h - walk a line segment through the cells of a grid
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+
+// visit, in order, every unit cell [ix,ix+1)x[iy,iy+1) that the segment
+// from (x0,y0) to (x1,y1) passes through, Amanatides-Woo style; visit gets
+// (ix, iy, ta, tb) where [ta,tb] is the part of the segment, as a 0..1
+// fraction of its length, inside that cell; cells only touched at a single
+// point are skipped unless the segment has no length at all
+template <class Visit>
+void traverse_cells(const double x0, const double y0, const double x1, const double y1,
+                    Visit visit) {
+
+  const double inf = std::numeric_limits<double>::infinity();
+  int64_t ix = (int64_t)std::floor(x0);
+  int64_t iy = (int64_t)std::floor(y0);
+  const int64_t ex = (int64_t)std::floor(x1);
+  const int64_t ey = (int64_t)std::floor(y1);
+
+  const double dx = x1 - x0;
+  const double dy = y1 - y0;
+  const int64_t stepx = (dx > 0.0) ? 1 : -1;
+  const int64_t stepy = (dy > 0.0) ? 1 : -1;
+
+  // parameter of the next vertical and horizontal cell edge, and between edges
+  double tmaxx = (dx != 0.0) ? ((stepx > 0 ? ix+1 : ix) - x0) / dx : inf;
+  double tmaxy = (dy != 0.0) ? ((stepy > 0 ? iy+1 : iy) - y0) / dy : inf;
+  const double tdeltax = (dx != 0.0) ? stepx / dx : inf;
+  const double tdeltay = (dy != 0.0) ? stepy / dy : inf;
+
+  const int64_t nsteps = std::abs(ex - ix) + std::abs(ey - iy);
+  double t = 0.0;
+  for (int64_t s=0; s<nsteps; ++s) {
+    if (tmaxx < tmaxy) {
+      if (tmaxx > t) visit(ix, iy, t, tmaxx);
+      t = tmaxx;
+      ix += stepx;
+      tmaxx += tdeltax;
+    } else {
+      if (tmaxy > t) visit(ix, iy, t, tmaxy);
+      t = tmaxy;
+      iy += stepy;
+      tmaxy += tdeltay;
+    }
+  }
+  if (t < 1.0 || nsteps == 0) visit(ix, iy, std::min(t, 1.0), 1.0);
+}
@@ -0,0 +1,135 @@
+//
+// viewshed.cpp - which dem cells an observer can see
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "viewshed.h"
+#include "parallel.h"
+#include "memory.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+
+// earth radius, stretched by the usual 0.13 refraction coefficient
+static const double earth_radius = 6371000.0 / (1.0 - 0.13);
+
+// the observer's cell and eye elevation, and the dem's vertical scale
+struct Sight {
+  int64_t x0, y0;
+  float zeye, zlo, zscale, cellsize;
+  bool curvature;
+
+  Sight(DemGrid& grid, const Observer& obs) {
+    x0 = std::max((int64_t)0, std::min(grid.nx-1, (int64_t)std::lround(obs.x)));
+    y0 = std::max((int64_t)0, std::min(grid.ny-1, (int64_t)std::lround(obs.y)));
+    zlo = obs.zlo;
+    zscale = obs.zhi - obs.zlo;
+    cellsize = obs.cellsize;
+    curvature = obs.curvature;
+    DemSampler ds(grid);
+    zeye = zlo + zscale * ds.at(x0, y0) + obs.height;
+  }
+
+  // tangent of the sight line to dem value z, d cells away
+  float slope(const float z, const float d) const {
+    const float dist = d * cellsize;
+    float zm = zlo + zscale * z;
+    if (curvature) zm -= (float)(0.5 * dist * dist / earth_radius);
+    return (zm - zeye) / dist;
+  }
+};
+
+unsigned char* viewshed(DemGrid& grid, const Observer& obs, const size_t nthreads) {
+  const Sight s(grid, obs);
+  const int64_t nx = grid.nx;
+  const int64_t ny = grid.ny;
+
+  // rays may cross a cell more than once, and near sector edges from
+  // different threads, so cells only ever go from hidden to visible, and
+  // by relaxed atomic stores
+  const int tag = mem_set_tag(MEM_PROFIMG);
+  unsigned char* vis = (unsigned char*)mem_alloc((size_t)nx*ny);
+  mem_set_tag(tag);
+  memset(vis, 0, (size_t)nx*ny);
+  vis[s.y0*nx + s.x0] = 1;
+
+  // border cells, counterclockwise from the origin, so that each
+  // block of rays is one sector
+  const int64_t nborder = std::max((int64_t)1, 2*(nx-1) + 2*(ny-1));
+  auto border = [&](int64_t k, int64_t& bx, int64_t& by) {
+    if (k < nx-1) { bx = k; by = 0; return; }
+    k -= nx-1;
+    if (k < ny-1) { bx = nx-1; by = k; return; }
+    k -= ny-1;
+    if (k < nx-1) { bx = nx-1-k; by = ny-1; return; }
+    k -= nx-1;
+    bx = 0; by = ny-1-k;
+  };
+
+  const int64_t block = 256;
+  parallel_for((nborder+block-1)/block, nthreads, [&](const size_t b) {
+    DemSampler ds(grid);
+    for (int64_t r=b*block; r<std::min(nborder, (int64_t)(b+1)*block); ++r) {
+      int64_t bx, by;
+      border(r, bx, by);
+      const int64_t dx = bx - s.x0;
+      const int64_t dy = by - s.y0;
+      const int64_t n = std::max(std::abs(dx), std::abs(dy));
+      if (n == 0) continue;
+      const float step = std::hypot((float)dx, (float)dy) / n;
+
+      // one sample per row or column crossed
+      float best = -1.e+30f;
+      for (int64_t k=1; k<=n; ++k) {
+        const float x = s.x0 + (float)dx*k/n;
+        const float y = s.y0 + (float)dy*k/n;
+        const float t = s.slope(ds.bilinear(x, y), k*step);
+        if (t >= best) {
+          __atomic_store_n(&vis[std::lround(y)*nx + std::lround(x)], (unsigned char)1, __ATOMIC_RELAXED);
+          best = t;
+        }
+      }
+    }
+  });
+
+  return vis;
+}
+
+double viewshed_check(DemGrid& grid, const Observer& obs, const size_t maxcells,
+                      const size_t nthreads, const unsigned char* vis) {
+  const Sight s(grid, obs);
+  const int64_t nx = grid.nx;
+  const int64_t ny = grid.ny;
+  const int64_t stride = std::max((int64_t)1,
+                         (int64_t)std::ceil(std::sqrt((double)nx*ny / std::max((size_t)1, maxcells))));
+  const int64_t cx = (nx+stride-1)/stride;
+  const int64_t cy = (ny+stride-1)/stride;
+
+  std::atomic<int64_t> agree(0);
+  parallel_for(cx, nthreads, [&](const size_t ci) {
+    DemSampler ds(grid);
+    int64_t mine = 0;
+    const int64_t i = ci*stride;
+    for (int64_t j=0; j<ny; j+=stride) {
+      const int64_t dx = i - s.x0;
+      const int64_t dy = j - s.y0;
+      const int64_t n = std::max(std::abs(dx), std::abs(dy));
+      bool visible = true;
+      if (n > 0) {
+        const float step = std::hypot((float)dx, (float)dy) / n;
+        float best = -1.e+30f;
+        for (int64_t k=1; k<n; ++k) {
+          best = std::max(best, s.slope(ds.bilinear(s.x0 + (float)dx*k/n, s.y0 + (float)dy*k/n), k*step));
+        }
+        visible = (s.slope(ds.at(i, j), n*step) >= best);
+      }
+      if (visible == (vis[j*nx+i] != 0)) ++mine;
+    }
+    agree += mine;
+  });
+  return (double)agree / (cx*cy);
+}
@@ -0,0 +1,26 @@
+//
+// viewshed.h - which dem cells an observer can see
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "dem.h"
+#include "horizon.h"
+
+#include <cstddef>
+
+// return a mask of one byte per cell, row after row from the bottom, so
+// that (i,j) is at j*nx+i: 1 where the observer can see the cell and 0
+// where not; R2 style: one ray to every cell on the dem's border, sampled
+// bilinearly where it crosses each row or column, sets each cell it
+// passes by comparing the sight line there with the steepest one so far;
+// rays are split into sectors over nthreads threads; free with mem_free
+unsigned char* viewshed(DemGrid& grid, const Observer& obs, const size_t nthreads);
+
+// compare vis against a separate ray cast from the observer to each of
+// up to maxcells cells, spread evenly over the dem, and return the
+// fraction that agree
+double viewshed_check(DemGrid& grid, const Observer& obs, const size_t maxcells,
+                      const size_t nthreads, const unsigned char* vis);
@@ -0,0 +1,189 @@
+//
+// xyz.cpp - slippy-map (z/x/y.png) elevation tile pyramids
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#include "xyz.h"
+#include "inout.h"
+#include "parallel.h"
+
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <set>
+#include <dirent.h>
+#include <unistd.h>
+
+// list the numeric entries of a directory
+static std::vector<int64_t> numeric_entries(const std::string& dir) {
+  std::vector<int64_t> vals;
+  DIR* dp = opendir(dir.c_str());
+  if (!dp) return vals;
+  while (struct dirent* ent = readdir(dp)) {
+    char* end;
+    const long long v = strtoll(ent->d_name, &end, 10);
+    if (end != ent->d_name && (*end == '\0' || std::string(end) == ".png")) vals.push_back(v);
+  }
+  closedir(dp);
+  std::sort(vals.begin(), vals.end());
+  return vals;
+}
+
+static std::string tile_path(const std::string& root, const int z, const int64_t tx, const int64_t ty) {
+  return root + "/" + std::to_string(z) + "/" + std::to_string(tx) + "/" + std::to_string(ty) + ".png";
+}
+
+//
+// find the zoom levels and tile size, and project the bounding box
+//
+XyzPyramid::XyzPyramid(const std::string& _root, const std::vector<double>& _bounds)
+  : root(_root) {
+
+  const std::vector<int64_t> zooms = numeric_entries(root);
+  if (zooms.empty()) {
+    std::cerr << "No zoom level directories found in " << root << "\n";
+    exit(0);
+  }
+  zmin = zooms.front();
+  zmax = zooms.back();
+
+  // take the tile size from any one tile at the finest level
+  tsize = 0;
+  const std::string zdir = root + "/" + std::to_string(zmax);
+  for (const int64_t tx : numeric_entries(zdir)) {
+    const std::vector<int64_t> tys = numeric_entries(zdir + "/" + std::to_string(tx));
+    if (tys.empty()) continue;
+    int hgt, wdt;
+    (void) read_png_res (tile_path(root, zmax, tx, tys[0]).c_str(), &hgt, &wdt);
+    tsize = wdt;
+    break;
+  }
+  if (tsize <= 0) {
+    std::cerr << "No tiles found in " << zdir << "\n";
+    exit(0);
+  }
+
+  // bounds are west,south,east,north in degrees
+  if (_bounds.size() != 4 || _bounds[0] >= _bounds[2] || _bounds[1] >= _bounds[3]) {
+    std::cerr << "Tile pyramids need --bounds west,south,east,north\n";
+    exit(0);
+  }
+  const double pi = std::atan(1.0)*4.0;
+  auto merc_x = [&](const double lon) { return (lon + 180.0) / 360.0; };
+  auto merc_y = [&](const double lat) {
+    const double rad = lat * pi / 180.0;
+    return 0.5 * (1.0 - std::log(std::tan(rad) + 1.0/std::cos(rad)) / pi);
+  };
+  mx0 = merc_x(_bounds[0]);
+  mx1 = merc_x(_bounds[2]);
+  my0 = merc_y(_bounds[3]);
+  my1 = merc_y(_bounds[1]);
+
+  std::cout << "  tile pyramid has zooms " << zmin << ".." << zmax << " of " << tsize << "^2 tiles\n";
+}
+
+int64_t XyzPyramid::left(const int z) const {
+  return (int64_t)std::floor(mx0 * tsize * std::ldexp(1.0, z));
+}
+
+int64_t XyzPyramid::top(const int z) const {
+  return (int64_t)std::floor(my0 * tsize * std::ldexp(1.0, z));
+}
+
+int64_t XyzPyramid::width(const int z) const {
+  return std::max((int64_t)1, (int64_t)std::ceil(mx1 * tsize * std::ldexp(1.0, z)) - left(z));
+}
+
+int64_t XyzPyramid::height(const int z) const {
+  return std::max((int64_t)1, (int64_t)std::ceil(my1 * tsize * std::ldexp(1.0, z)) - top(z));
+}
+
+int XyzPyramid::zoom_for(const double linelength, const size_t nsamples) const {
+  // each zoom level down halves the line's length in pixels
+  const double levels = std::log2(linelength / std::max((size_t)1, nsamples));
+  const int z = zmax - (int)std::lround(levels);
+  return std::max(zmin, std::min(zmax, z));
+}
+
+//
+// one zoom level as a grid
+//
+XyzDem::XyzDem(const XyzPyramid& _pyr, const int _zoom, const DemEncoding& _enc,
+               const size_t budget)
+  : DemGrid(_pyr.width(_zoom), _pyr.height(_zoom)),
+    pyr(_pyr),
+    zoom(_zoom),
+    enc(_enc),
+    gx0(_pyr.left(_zoom)),
+    gy0(_pyr.top(_zoom)),
+    ntiles((int64_t)1 << _zoom),
+    cache(budget, [this](const int64_t key) { return decode(key); }) {
+  zeros.assign(pyr.tsize, 0.f);
+  std::cout << "  using zoom " << zoom << ", grid is " << nx << " x " << ny
+            << ", caching up to " << (budget >> 20) << " MB of tiles\n";
+}
+
+int64_t XyzDem::key_of(const int64_t ix, const int64_t iy) const {
+  const int64_t gx = gx0 + ix;
+  const int64_t gy = gy0 + (ny - 1 - iy);
+  return (gy / pyr.tsize) * ntiles + gx / pyr.tsize;
+}
+
+std::shared_ptr<DemTile> XyzDem::decode(const int64_t key) {
+  const int64_t ts = pyr.tsize;
+  const int64_t tx = key % ntiles;
+  const int64_t ty = key / ntiles;
+
+  std::shared_ptr<DemTile> t = std::make_shared<DemTile>();
+  t->x0 = tx*ts - gx0;
+  t->y0 = ny + gy0 - (ty+1)*ts;
+  t->nx = ts;
+  t->ny = ts;
+
+  const std::string path = tile_path(pyr.root, zoom, tx, ty);
+  if (access(path.c_str(), R_OK) != 0) {
+    // pyramids usually leave out empty tiles; share one column of zeros
+    t->ystride = 0;
+    t->data = zeros.data();
+    return t;
+  }
+
+  t->ystride = ts;
+  t->store.resize(ts * ts);
+  t->data = t->store.data();
+  std::vector<float*> cols(ts);
+  for (int64_t i=0; i<ts; ++i) cols[i] = t->store.data() + i*ts;
+  read_dem_png(path, ts, ts, enc, cols.data());
+  return t;
+}
+
+TilePtr XyzDem::tile_at(const int64_t ix, const int64_t iy) {
+  return cache.get(key_of(ix, iy));
+}
+
+void XyzDem::prefetch_line(const float sx, const float sy, const float fx, const float fy,
+                           const size_t nthreads) {
+
+  // step along the line well inside a tile width, and include the
+  // neighbors that bilinear sampling reads
+  std::set<int64_t> keys;
+  const double len = std::sqrt((double)(fx-sx)*(fx-sx) + (double)(fy-sy)*(fy-sy));
+  const int64_t nsteps = 1 + (int64_t)(len / 8.0);
+  for (int64_t s=0; s<=nsteps; ++s) {
+    const double w = (double)s / nsteps;
+    const int64_t ix = (int64_t)(sx*(1.0-w) + fx*w);
+    const int64_t iy = (int64_t)(sy*(1.0-w) + fy*w);
+    for (int64_t di=0; di<2; ++di) {
+      for (int64_t dj=0; dj<2; ++dj) {
+        const int64_t cx = std::max((int64_t)0, std::min(nx-1, ix+di));
+        const int64_t cy = std::max((int64_t)0, std::min(ny-1, iy+dj));
+        keys.insert(key_of(cx, cy));
+      }
+    }
+  }
+
+  const std::vector<int64_t> list(keys.begin(), keys.end());
+  parallel_for(list.size(), nthreads, [&](const size_t i) { (void) cache.get(list[i]); });
+  std::cout << "  prefetched " << list.size() << " tiles along the line\n";
+}
@@ -0,0 +1,65 @@
+//
+// xyz.h - slippy-map (z/x/y.png) elevation tile pyramids
+//
+// (c)2023 Mark J. Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "dem.h"
+
+#include <string>
+#include <vector>
+
+// a directory tree of root/z/x/y.png tiles in web mercator, cropped to a
+// lon/lat bounding box; the box's pixel size depends on the zoom level
+class XyzPyramid {
+public:
+  XyzPyramid(const std::string& _root, const std::vector<double>& _bounds);
+
+  // grid size of the bounding box at zoom z
+  int64_t width(const int z) const;
+  int64_t height(const int z) const;
+
+  // zoom whose pixel size best matches nsamples samples along a line
+  // that is linelength pixels long at the finest zoom
+  int zoom_for(const double linelength, const size_t nsamples) const;
+
+  // top-left global pixel of the bounding box at zoom z
+  int64_t left(const int z) const;
+  int64_t top(const int z) const;
+
+  std::string root;
+  int zmin, zmax;
+  int64_t tsize;
+  // bounding box in normalized web mercator, 0..1 with y down
+  double mx0, my0, mx1, my1;
+};
+
+// one zoom level of an XyzPyramid as a grid; tiles are decoded on first
+// touch into a byte-bounded cache, and missing tiles read as zero
+class XyzDem : public DemGrid {
+public:
+  XyzDem(const XyzPyramid& _pyr, const int _zoom, const DemEncoding& _enc,
+         const size_t budget);
+  TilePtr tile_at(const int64_t ix, const int64_t iy) override;
+  size_t tiles_loaded() const override { return cache.loads(); }
+  int zoom_level() const { return zoom; }
+
+  // decode, in parallel, every tile that sampling the line
+  // from (sx,sy) to (fx,fy) will touch
+  void prefetch_line(const float sx, const float sy, const float fx, const float fy,
+                     const size_t nthreads);
+
+private:
+  int64_t key_of(const int64_t ix, const int64_t iy) const;
+  std::shared_ptr<DemTile> decode(const int64_t key);
+
+  const XyzPyramid& pyr;
+  const int zoom;
+  const DemEncoding enc;
+  const int64_t gx0, gy0;       // global pixel of grid cell (0, ny-1)
+  const int64_t ntiles;         // tiles across the world at this zoom
+  std::vector<float> zeros;
+  TileCache cache;
+};